@@ -0,0 +1,109 @@
+#ifndef ARC_LENGTH_H
+#define ARC_LENGTH_H
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// for convenience
+using std::vector;
+
+//
+// Arc length table of a smooth curve, for sampling it at given distances.
+//
+// The curve is any type with a speed(t) member returning |dC/dt| at the
+// curve parameter t, e.g. sqrt(x'(t)^2 + y'(t)^2) for a parametric curve
+// like tk::fixed_spline2d. build() splits the
+// parameter range into segments and integrates the speed over each one
+// with 5 point Gauss-Legendre quadrature, which on meter long segments of
+// a cubic spline is accurate to far below a millimeter.
+//
+// params_at() maps arc lengths back to parameters. Within a segment t(s) is
+// a cubic Hermite interpolant, using dt/ds = 1/speed stored at the segment
+// ends, so no quadrature runs per query. Past either end the last slope is
+// extended. The table keeps its storage between builds, so one instance
+// can be rebuilt every tick without allocating, and queries can run any
+// number of times while the curve is unchanged.
+//
+
+class ArcLengthTable {
+ public:
+  ArcLengthTable() {}
+
+  // Integrates curve.speed(t) over [t0, t1] in the given number of segments
+  template <typename Curve>
+  void build(double t0, double t1, int segments, const Curve &curve) {
+    // nodes and weights on [-1, 1]
+    static const double node[5] = {0.0, -0.5384693101056831, 0.5384693101056831,
+                                   -0.9061798459386640, 0.9061798459386640};
+    static const double weight[5] = {0.5688888888888889, 0.4786286704993665,
+                                     0.4786286704993665, 0.2369268850561891,
+                                     0.2369268850561891};
+    segments = std::max(segments, 1);
+    t_.resize(segments + 1);
+    s_.resize(segments + 1);
+    dtds_.resize(segments + 1);
+    double h = (t1 - t0) / segments;
+    t_[0] = t0;
+    s_[0] = 0.0;
+    dtds_[0] = 1.0 / curve.speed(t0);
+    for (int i = 0; i < segments; ++i) {
+      double a = t0 + i * h;
+      double mid = a + 0.5 * h;
+      double sum = 0.0;
+      for (int k = 0; k < 5; ++k) {
+        sum += weight[k] * curve.speed(mid + 0.5 * h * node[k]);
+      }
+      t_[i+1] = (i + 1 == segments) ? t1 : a + h;
+      s_[i+1] = s_[i] + 0.5 * h * sum;
+      dtds_[i+1] = 1.0 / curve.speed(t_[i+1]);
+    }
+  }
+
+  // Arc length from the start of the range to its end
+  double length() const { return s_.empty() ? 0.0 : s_.back(); }
+
+  // Curve parameter at arc length s from the start of the range
+  double param_at(double s) const {
+    int hint = 0;
+    return param_at(s, hint);
+  }
+
+  // Curve parameters at n arc lengths, fastest when s[] is sorted
+  void params_at(const double *s, int n, double *t) const {
+    int hint = 0;
+    for (int k = 0; k < n; ++k) {
+      t[k] = param_at(s[k], hint);
+    }
+  }
+
+ private:
+  // segment ends: parameter, arc length and dt/ds
+  vector<double> t_;
+  vector<double> s_;
+  vector<double> dtds_;
+
+  // hint carries the segment between queries
+  double param_at(double s, int &hint) const {
+    int last = (int)s_.size() - 1;
+    if (s <= 0.0) return t_[0] + s * dtds_[0];
+    if (s >= s_[last]) return t_[last] + (s - s_[last]) * dtds_[last];
+    int i = std::min(std::max(hint, 0), last - 1);
+    while (i < last - 1 && s > s_[i+1]) ++i;
+    while (i > 0 && s < s_[i]) --i;
+    hint = i;
+
+    // cubic Hermite interpolation of t(s) on the segment
+    double ds = s_[i+1] - s_[i];
+    double u = (s - s_[i]) / ds;
+    double u2 = u * u;
+    double u3 = u2 * u;
+    double h00 = 2*u3 - 3*u2 + 1;
+    double h10 = u3 - 2*u2 + u;
+    double h01 = -2*u3 + 3*u2;
+    double h11 = u3 - u2;
+    return h00 * t_[i] + h10 * ds * dtds_[i] + h01 * t_[i+1] + h11 * ds * dtds_[i+1];
+  }
+};
+
+#endif  // ARC_LENGTH_H
@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "collision.h"
+#include "sensor_fusion.h"
+
+// for convenience
+using std::vector;
+
+//
+// Benchmark of the collision checks against growing traffic.
+//
+// For 10, 100 and 1000 vehicles spread over a three lane road at the same
+// density, the same set of ego candidates, lane keeping and lane changes at
+// several speeds, is checked by the CollisionChecker and by a brute force
+// check that predicts and tests every vehicle at every time step. The broad
+// phase of the checker only hands the vehicles around the ego to the narrow
+// phase, so its cost per candidate should stay about flat while the brute
+// force grows with the traffic. The pairs the broad phase lets through are
+// counted too, as the narrow phase work per candidate. Both checks must agree
+// on every candidate.
+//
+// usage: bench_collision [candidates] [steps]
+//
+//   candidates  ego candidates per traffic size, defaults to 300
+//   steps       time steps of 0.1s per candidate, defaults to 41
+//
+
+// the lattice defaults
+const double VEHICLE_LENGTH = 5.0;
+const double VEHICLE_WIDTH = 2.0;
+const double MIN_GAP = 3.0;
+const double MIN_LATERAL_GAP = 1.0;
+const double DT = 0.1;
+
+/*
+* every vehicle against every ego pose, with the same boxes and separating axis test as the
+* CollisionChecker
+*/
+bool collides_brute(const SensorFusionFrame &traffic, const double *s, const double *d,
+                    const double *yaw, int n) {
+  const double el = 0.5 * VEHICLE_LENGTH + MIN_GAP;
+  const double ew = 0.5 * VEHICLE_WIDTH + MIN_LATERAL_GAP;
+  const double vl = 0.5 * VEHICLE_LENGTH;
+  const double vw = 0.5 * VEHICLE_WIDTH;
+  for (int k = 0; k < n; ++k) {
+    double c = cos(yaw[k]);
+    double sn = sin(yaw[k]);
+    double ac = fabs(c);
+    double as = fabs(sn);
+    for (int i = 0; i < traffic.size(); ++i) {
+      double tx = traffic.s[i] + k * DT * traffic.speed[i] - s[k];
+      double ty = traffic.d[i] - d[k];
+      if (fabs(tx) > vl + el*ac + ew*as) continue;
+      if (fabs(ty) > vw + el*as + ew*ac) continue;
+      if (fabs(tx*c + ty*sn) > el + vl*ac + vw*as) continue;
+      if (fabs(ty*c - tx*sn) > ew + vl*as + vw*ac) continue;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+* vehicle and ego pose pairs within the reach of the broad phase, the pairs the narrow phase
+* of the CollisionChecker tests
+*/
+int broad_phase_pairs(const SensorFusionFrame &traffic, const double *s, int n) {
+  const double el = 0.5 * VEHICLE_LENGTH + MIN_GAP;
+  const double ew = 0.5 * VEHICLE_WIDTH + MIN_LATERAL_GAP;
+  const double vl = 0.5 * VEHICLE_LENGTH;
+  const double vw = 0.5 * VEHICLE_WIDTH;
+  double reach = sqrt(vl*vl + vw*vw) + sqrt(el*el + ew*ew);
+  int pairs = 0;
+  for (int k = 0; k < n; ++k) {
+    for (int i = 0; i < traffic.size(); ++i) {
+      pairs += fabs(traffic.s[i] + k * DT * traffic.speed[i] - s[k]) <= reach;
+    }
+  }
+  return pairs;
+}
+
+int main(int argc, char *argv[]) {
+  int candidates = (argc > 1) ? atoi(argv[1]) : 300;
+  int steps = (argc > 2) ? atoi(argv[2]) : 41;
+  if (candidates < 1 || steps < 2) {
+    std::cerr << "usage: bench_collision [candidates] [steps]" << std::endl;
+    return -1;
+  }
+
+  std::mt19937 rng(1);
+  int mismatches = 0;
+  const int vehicle_counts[3] = {10, 100, 1000};
+  for (int v = 0; v < 3; ++v) {
+    int vehicles = vehicle_counts[v];
+    // one vehicle every 100m per lane on average
+    double road_length = vehicles * 100.0 / 3;
+    std::uniform_real_distribution<double> random_s(0.0, road_length);
+    std::uniform_real_distribution<double> random_speed(15.0, 22.0);
+    std::uniform_int_distribution<int> random_lane(0, 2);
+    SensorFusionFrame traffic;
+    for (int i = 0; i < vehicles; ++i) {
+      double s = random_s(rng);
+      double speed = random_speed(rng);
+      traffic.push_back(i, 0.0, 0.0, speed, 0.0, s, 2.0 + 4.0 * random_lane(rng));
+    }
+
+    // candidates from anywhere but the ends of the road: a lane change or
+    // not, at a target speed, as straight lines in s and d
+    vector<double> s(candidates * steps), d(candidates * steps), yaw(candidates * steps);
+    std::uniform_real_distribution<double> random_start(0.1 * road_length, 0.9 * road_length);
+    std::uniform_real_distribution<double> random_target(15.0, 22.0);
+    for (int c = 0; c < candidates; ++c) {
+      double s0 = random_start(rng);
+      int lane0 = random_lane(rng);
+      int lane1 = std::min(std::max(lane0 + random_lane(rng) - 1, 0), 2);
+      double vs = random_target(rng);
+      double vd = 4.0 * (lane1 - lane0) / ((steps - 1) * DT);
+      for (int k = 0; k < steps; ++k) {
+        s[c*steps + k] = s0 + k * DT * vs;
+        d[c*steps + k] = 2.0 + 4.0 * lane0 + k * DT * vd;
+        yaw[c*steps + k] = atan2(vd, vs);
+      }
+    }
+
+    CollisionChecker checker(VEHICLE_LENGTH, VEHICLE_WIDTH, MIN_GAP, MIN_LATERAL_GAP);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    checker.predict(traffic, 0.0, DT, steps);
+    double predict_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    vector<char> hit_checker(candidates), hit_brute(candidates);
+    start = std::chrono::steady_clock::now();
+    for (int c = 0; c < candidates; ++c) {
+      hit_checker[c] = checker.collides(&s[c*steps], &d[c*steps], &yaw[c*steps], steps);
+    }
+    double checker_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int c = 0; c < candidates; ++c) {
+      hit_brute[c] = collides_brute(traffic, &s[c*steps], &d[c*steps], &yaw[c*steps], steps);
+    }
+    double brute_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int collisions = 0;
+    long pairs = 0;
+    for (int c = 0; c < candidates; ++c) {
+      collisions += hit_checker[c];
+      mismatches += hit_checker[c] != hit_brute[c];
+      pairs += broad_phase_pairs(traffic, &s[c*steps], steps);
+    }
+    std::cout << vehicles << " vehicles, " << candidates << " candidates of " << steps
+              << " steps, " << collisions << " colliding" << std::endl;
+    std::cout << "  narrow phase:      " << (double)pairs / candidates << " pairs/candidate, of "
+              << vehicles * steps << std::endl;
+    std::cout << "  predict:           " << predict_s * 1e6 << " us per tick" << std::endl;
+    std::cout << "  CollisionChecker:  " << checker_s / candidates * 1e6 << " us/candidate" << std::endl;
+    std::cout << "  brute force:       " << brute_s / candidates * 1e6 << " us/candidate" << std::endl;
+    std::cout << "  speedup " << brute_s / checker_s << "x" << std::endl;
+  }
+  std::cout << "checks disagree on " << mismatches << " candidates" << std::endl;
+  return mismatches == 0 ? 0 : 1;
+}
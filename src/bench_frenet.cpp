@@ -0,0 +1,112 @@
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "helpers.h"
+#include "map.h"
+#include "map_file.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Benchmark of Cartesian to Frenet conversions against the waypoint map.
+//
+// Random points on and around the road are converted by the original
+// helpers.h getFrenet(), which scans every waypoint and sums the arc length
+// up to the segment on each call, by Map::getFrenet() with its spatial index
+// and arc length table, and by the batched Map::getFrenet(). The original
+// only runs on a subset of the points, it is orders of magnitude slower.
+//
+// usage: bench_frenet <map.csv> [points]
+//
+//   points  points converted per implementation, defaults to 100000
+//
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: bench_frenet <map.csv> [points]" << std::endl;
+    return -1;
+  }
+  string csv_file = argv[1];
+  int n = (argc > 2) ? atoi(argv[2]) : 100000;
+
+  vector<double> map_waypoints_x;
+  vector<double> map_waypoints_y;
+  vector<double> map_waypoints_s;
+  vector<double> map_waypoints_dx;
+  vector<double> map_waypoints_dy;
+  if (!load_map_csv(csv_file, map_waypoints_x, map_waypoints_y, map_waypoints_s,
+                    map_waypoints_dx, map_waypoints_dy) || map_waypoints_x.size() < 3) {
+    std::cerr << "Failed to read waypoints from " << csv_file << std::endl;
+    return -1;
+  }
+  // The max s value before wrapping around the track back to 0
+  double max_s = loop_length(map_waypoints_x, map_waypoints_y, map_waypoints_s);
+  Map map(map_waypoints_x, map_waypoints_y, map_waypoints_s,
+          map_waypoints_dx, map_waypoints_dy, max_s);
+
+  // points across the three lanes and a little beyond, heading along the road
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> random_s(0.0, max_s);
+  std::uniform_real_distribution<double> random_d(-1.0, 13.0);
+  vector<double> x(n), y(n), theta(n);
+  for (int i = 0; i < n; ++i) {
+    double s = random_s(rng);
+    vector<double> xy = map.getXY(s, random_d(rng));
+    x[i] = xy[0];
+    y[i] = xy[1];
+    theta[i] = map.segment_heading(map.segment_at(s));
+  }
+  vector<double> s_map(n), d_map(n), s_batch(n), d_batch(n);
+
+  // the original scans the whole map twice per point
+  int n_helpers = std::max(std::min(n, 2000000 / map.size()), 1);
+  double checksum = 0.0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n_helpers; ++i) {
+    vector<double> sd = getFrenet(x[i], y[i], theta[i], map_waypoints_x, map_waypoints_y);
+    checksum += sd[0] + sd[1];
+  }
+  double helpers_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    vector<double> sd = map.getFrenet(x[i], y[i], theta[i]);
+    s_map[i] = sd[0];
+    d_map[i] = sd[1];
+  }
+  double map_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  map.getFrenet(x.data(), y.data(), theta.data(), n, s_batch.data(), d_batch.data());
+  double batch_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // the implementations must agree, up to the s column of the csv against
+  // the summed segment lengths of the original
+  double max_ds = 0.0;
+  double max_dd = 0.0;
+  for (int i = 0; i < n_helpers; ++i) {
+    vector<double> sd = getFrenet(x[i], y[i], theta[i], map_waypoints_x, map_waypoints_y);
+    max_ds = std::max(max_ds, fabs(sd[0] - s_map[i]));
+    max_dd = std::max(max_dd, fabs(sd[1] - d_map[i]));
+  }
+  for (int i = 0; i < n; ++i) {
+    max_ds = std::max(max_ds, fabs(s_batch[i] - s_map[i]));
+    max_dd = std::max(max_dd, fabs(d_batch[i] - d_map[i]));
+  }
+
+  std::cout << map.size() << " waypoints, " << n << " points" << std::endl;
+  std::cout << "helpers.h getFrenet: " << n_helpers / helpers_s << " points/s ("
+            << n_helpers << " points)" << std::endl;
+  std::cout << "Map::getFrenet:      " << n / map_s << " points/s" << std::endl;
+  std::cout << "batched getFrenet:   " << n / batch_s << " points/s" << std::endl;
+  std::cout << "largest difference: s " << max_ds << " m, d " << max_dd << " m"
+            << " (checksum " << checksum << ")" << std::endl;
+  return 0;
+}
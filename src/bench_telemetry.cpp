@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "capture_log.h"
+#include "helpers.h"
+#include "json.hpp"
+#include "telemetry.h"
+
+// for convenience
+using nlohmann::json;
+using std::string;
+using std::vector;
+
+//
+// Microbenchmark of the telemetry decoding on recorded frames.
+//
+// Every telemetry frame of a capture written by path_planning -c is decoded
+// over and over, once per pass, by the schema-aware parser and by the path
+// it replaced: hasData() on a copy of the frame, a json::parse DOM and the
+// fields copied out of it. Both decoders are checked to agree on every
+// frame before timing.
+//
+// usage: bench_telemetry <capture.log> [passes]
+//
+//   passes  times every frame is decoded by each decoder, defaults to 200
+//
+
+// Fields of one frame as the json path left them
+struct JsonTelemetry {
+  double x, y, s, d, yaw, speed;
+  vector<double> previous_path_x;
+  vector<double> previous_path_y;
+  double end_path_s, end_path_d;
+  vector<vector<double>> sensor_fusion;
+};
+
+/*
+* the decoding main.cpp used to do, returns false when the frame has no data
+*/
+bool parse_json(const char *data, size_t length, JsonTelemetry &t) {
+  auto s = hasData(string(data, length));
+  if (s == "") return false;
+  auto j = json::parse(s);
+  if (j[0].get<string>() != "telemetry") return false;
+  t.x = j[1]["x"];
+  t.y = j[1]["y"];
+  t.s = j[1]["s"];
+  t.d = j[1]["d"];
+  t.yaw = j[1]["yaw"];
+  t.speed = j[1]["speed"];
+  t.previous_path_x = j[1]["previous_path_x"].get<vector<double>>();
+  t.previous_path_y = j[1]["previous_path_y"].get<vector<double>>();
+  t.end_path_s = j[1]["end_path_s"];
+  t.end_path_d = j[1]["end_path_d"];
+  t.sensor_fusion = j[1]["sensor_fusion"].get<vector<vector<double>>>();
+  return true;
+}
+
+bool same(const JsonTelemetry &a, const Telemetry &b) {
+  bool ok = a.x == b.x && a.y == b.y && a.s == b.s && a.d == b.d &&
+            a.yaw == b.yaw && a.speed == b.speed &&
+            a.previous_path_x == b.previous_path_x &&
+            a.previous_path_y == b.previous_path_y &&
+            a.end_path_s == b.end_path_s && a.end_path_d == b.end_path_d &&
+            (int)a.sensor_fusion.size() == b.sensor_fusion.size();
+  for (int i = 0; ok && i < b.sensor_fusion.size(); ++i) {
+    const vector<double> &v = a.sensor_fusion[i];
+    ok = v.size() == 7 && v[0] == b.sensor_fusion.id[i] &&
+         v[1] == b.sensor_fusion.x[i] && v[2] == b.sensor_fusion.y[i] &&
+         v[3] == b.sensor_fusion.vx[i] && v[4] == b.sensor_fusion.vy[i] &&
+         v[5] == b.sensor_fusion.s[i] && v[6] == b.sensor_fusion.d[i];
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: bench_telemetry <capture.log> [passes]" << std::endl;
+    return -1;
+  }
+  string capture_file = argv[1];
+  int passes = (argc > 2) ? atoi(argv[2]) : 200;
+
+  CaptureReader capture;
+  if (!capture.open(capture_file)) {
+    std::cerr << "Failed to open capture " << capture_file << std::endl;
+    return -1;
+  }
+
+  // the telemetry frames of the capture, decoded in place from the mapping
+  vector<CaptureRecord> frames;
+  size_t bytes = 0;
+  Telemetry telemetry;
+  JsonTelemetry json_telemetry;
+  int mismatches = 0;
+  for (int i = 0; i < capture.size(); ++i) {
+    CaptureRecord record = capture.record(i);
+    if (record.type != CAPTURE_TELEMETRY) continue;
+    if (parse_telemetry(record.data, record.length, telemetry) != TELEMETRY_OK) continue;
+    if (!parse_json(record.data, record.length, json_telemetry) ||
+        !same(json_telemetry, telemetry)) {
+      ++mismatches;
+    }
+    frames.push_back(record);
+    bytes += record.length;
+  }
+  if (frames.empty()) {
+    std::cerr << "No telemetry frames in " << capture_file << std::endl;
+    return -1;
+  }
+
+  // checksums keep the decoded values alive
+  double checksum_parser = 0.0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; ++pass) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      parse_telemetry(frames[i].data, frames[i].length, telemetry);
+      checksum_parser += telemetry.x + telemetry.previous_path_x.size() +
+                         telemetry.sensor_fusion.size();
+    }
+  }
+  double parser_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double checksum_json = 0.0;
+  start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; ++pass) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      parse_json(frames[i].data, frames[i].length, json_telemetry);
+      checksum_json += json_telemetry.x + json_telemetry.previous_path_x.size() +
+                       json_telemetry.sensor_fusion.size();
+    }
+  }
+  double json_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double count = (double)frames.size() * passes;
+  double mb = (double)bytes * passes / 1e6;
+  std::cout << frames.size() << " telemetry frames, " << bytes / frames.size()
+            << " bytes on average, " << passes << " passes" << std::endl;
+  std::cout << "decoders disagree on " << mismatches << " frames" << std::endl;
+  std::cout << "telemetry parser: " << parser_s / count * 1e9 << " ns/frame, "
+            << mb / parser_s << " MB/s" << std::endl;
+  std::cout << "hasData + json:   " << json_s / count * 1e9 << " ns/frame, "
+            << mb / json_s << " MB/s" << std::endl;
+  std::cout << "speedup " << json_s / parser_s << "x" << std::endl;
+  return (checksum_parser == checksum_json && mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,297 @@
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Capture log of the messages exchanged with the simulator, for offline
+// replay.
+//
+// The log is append only. Each message becomes a record: a fixed header
+// with the time since the capture started, the session it belongs to, its
+// direction and its length, followed by the message bytes padded to 8. When
+// the capture is closed an index of the record offsets is appended with a
+// trailer pointing at it. Appending only copies the record into a buffer; a
+// writer thread of its own puts the buffer to disk, so the threads serving
+// the simulators never wait on file I/O. A reader maps the whole file, uses the index
+// when the trailer is there, and otherwise rebuilds it by walking the
+// records, so a capture cut short by a crash still replays up to its last
+// complete record. Message bytes are read in place from the mapping.
+//
+// Layout, all values in host byte order:
+//
+//   CaptureLogHeader
+//   per record: CaptureRecordHeader, char data[length], padding to 8
+//   uint64_t offset[record_count]   index, written by close()
+//   CaptureLogTrailer
+//
+
+const char CAPTURE_LOG_MAGIC[8] = {'P', 'P', 'C', 'A', 'P', 0, 0, 0};
+const char CAPTURE_INDEX_MAGIC[8] = {'P', 'P', 'C', 'I', 'D', 'X', 0, 0};
+const uint32_t CAPTURE_LOG_VERSION = 1;
+
+// direction of a captured message
+enum CaptureType {
+  CAPTURE_TELEMETRY = 1,  // websocket event from the simulator
+  CAPTURE_CONTROL = 2     // reply sent back to it
+};
+
+struct CaptureLogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct CaptureRecordHeader {
+  uint64_t timestamp_ns;  // since the capture started
+  uint32_t session;
+  uint16_t type;          // CaptureType
+  uint16_t reserved;
+  uint64_t length;        // message bytes, without padding
+};
+
+struct CaptureLogTrailer {
+  char magic[8];
+  uint64_t record_count;
+  uint64_t index_offset;
+};
+
+// One record, pointing into the mapped log
+struct CaptureRecord {
+  uint64_t timestamp_ns;
+  uint32_t session;
+  CaptureType type;
+  const char *data;
+  size_t length;
+};
+
+class CaptureWriter {
+ public:
+  CaptureWriter() {}
+  ~CaptureWriter() { close(); }
+
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  // Starts a new capture, returns false if the file can not be created
+  bool open(const string &file) {
+    close();
+    file_ = fopen(file.c_str(), "wb");
+    if (!file_) return false;
+    CaptureLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_LOG_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_LOG_VERSION;
+    fwrite(&header, sizeof(header), 1, file_);
+    offset_ = sizeof(header);
+    offsets_.clear();
+    pending_.clear();
+    stop_ = false;
+    start_ = std::chrono::steady_clock::now();
+    writer_ = std::thread(&CaptureWriter::write_loop, this);
+    return true;
+  }
+
+  bool is_open() const { return file_ != nullptr; }
+
+  // Appends one message, safe to call from any thread. The timestamp is
+  // taken under the lock, so records are in time order across threads.
+  void append(CaptureType type, uint32_t session, const char *data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_ || stop_) return;
+    CaptureRecordHeader record;
+    memset(&record, 0, sizeof(record));
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_).count();
+    record.session = session;
+    record.type = type;
+    record.length = length;
+    static const char padding[8] = {0};
+    size_t pad = (8 - length % 8) % 8;
+    pending_.insert(pending_.end(), (const char *)&record, (const char *)(&record + 1));
+    pending_.insert(pending_.end(), data, data + length);
+    pending_.insert(pending_.end(), padding, padding + pad);
+    offsets_.push_back(offset_);
+    offset_ += sizeof(record) + length + pad;
+    cond_.notify_one();
+  }
+
+  // Writes out the records still buffered, then the index, and closes the
+  // file
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!file_) return;
+      stop_ = true;
+    }
+    cond_.notify_one();
+    writer_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    CaptureLogTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+    trailer.record_count = offsets_.size();
+    trailer.index_offset = offset_;
+    fwrite(offsets_.data(), sizeof(uint64_t), offsets_.size(), file_);
+    fwrite(&trailer, sizeof(trailer), 1, file_);
+    fclose(file_);
+    file_ = nullptr;
+  }
+
+ private:
+  FILE *file_ = nullptr;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread writer_;
+  // guarded by mutex_: records appended but not yet handed to the writer,
+  // and set by close() to drain them and end the writer
+  vector<char> pending_;
+  bool stop_ = false;
+  uint64_t offset_ = 0;
+  // offset of every record appended so far, for the index
+  vector<uint64_t> offsets_;
+  std::chrono::steady_clock::time_point start_;
+
+  // takes every record buffered so far at once, and writes them with the
+  // lock released
+  void write_loop() {
+    vector<char> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+      if (pending_.empty()) return;
+      batch.swap(pending_);
+      lock.unlock();
+      fwrite(batch.data(), 1, batch.size(), file_);
+      // flushed per batch, so a capture cut short keeps what was written
+      fflush(file_);
+      batch.clear();
+      lock.lock();
+    }
+  }
+};
+
+class CaptureReader {
+ public:
+  CaptureReader() {}
+  ~CaptureReader() { close(); }
+
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+
+  // Maps a capture, returns false if it is missing or not a capture log
+  bool open(const string &file) {
+    close();
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CaptureLogHeader)) {
+      ::close(fd);
+      return false;
+    }
+    size_ = st.st_size;
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+    data_ = (const char *)data;
+
+    const CaptureLogHeader *header = (const CaptureLogHeader *)data_;
+    if (memcmp(header->magic, CAPTURE_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CAPTURE_LOG_VERSION) {
+      close();
+      return false;
+    }
+    if (!read_index()) scan();
+    return true;
+  }
+
+  void close() {
+    if (data_) munmap((void *)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    offsets_.clear();
+  }
+
+  int size() const { return offsets_.size(); }
+
+  CaptureRecord record(int i) const {
+    const CaptureRecordHeader *header = (const CaptureRecordHeader *)(data_ + offsets_[i]);
+    CaptureRecord record;
+    record.timestamp_ns = header->timestamp_ns;
+    record.session = header->session;
+    record.type = (CaptureType)header->type;
+    record.data = (const char *)(header + 1);
+    record.length = header->length;
+    return record;
+  }
+
+ private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  vector<uint64_t> offsets_;
+
+  // true when a whole record starts at offset, before end
+  bool valid_record(uint64_t offset, uint64_t end) const {
+    if (offset % 8 != 0 || offset < sizeof(CaptureLogHeader) || offset > end ||
+        end - offset < sizeof(CaptureRecordHeader)) {
+      return false;
+    }
+    const CaptureRecordHeader *header = (const CaptureRecordHeader *)(data_ + offset);
+    return (header->type == CAPTURE_TELEMETRY || header->type == CAPTURE_CONTROL) &&
+           header->length <= end - offset - sizeof(CaptureRecordHeader);
+  }
+
+  // index written by CaptureWriter::close(), rejected unless it and every
+  // record it points to lie within the file
+  bool read_index() {
+    if (size_ < sizeof(CaptureLogHeader) + sizeof(CaptureLogTrailer)) return false;
+    uint64_t index_end = size_ - sizeof(CaptureLogTrailer);
+    const CaptureLogTrailer *trailer = (const CaptureLogTrailer *)(data_ + index_end);
+    // the count is checked against the space left rather than multiplied,
+    // which could wrap around
+    if (memcmp(trailer->magic, CAPTURE_INDEX_MAGIC, sizeof(trailer->magic)) != 0 ||
+        trailer->index_offset % 8 != 0 || trailer->index_offset < sizeof(CaptureLogHeader) ||
+        trailer->index_offset > index_end ||
+        (index_end - trailer->index_offset) % sizeof(uint64_t) != 0 ||
+        trailer->record_count != (index_end - trailer->index_offset) / sizeof(uint64_t)) {
+      return false;
+    }
+    const uint64_t *index = (const uint64_t *)(data_ + trailer->index_offset);
+    for (uint64_t i = 0; i < trailer->record_count; ++i) {
+      if (!valid_record(index[i], trailer->index_offset)) return false;
+    }
+    offsets_.assign(index, index + trailer->record_count);
+    return true;
+  }
+
+  // walks the records of a capture that was not closed, or whose index is
+  // damaged, up to the first one that is cut short
+  void scan() {
+    offsets_.clear();
+    uint64_t offset = sizeof(CaptureLogHeader);
+    while (valid_record(offset, size_)) {
+      const CaptureRecordHeader *header = (const CaptureRecordHeader *)(data_ + offset);
+      uint64_t end = offset + sizeof(CaptureRecordHeader) + header->length;
+      offsets_.push_back(offset);
+      offset = end + (8 - header->length % 8) % 8;
+    }
+  }
+};
+
+#endif  // CAPTURE_LOG_H
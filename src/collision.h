@@ -0,0 +1,184 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "sensor_fusion.h"
+
+// for convenience
+using std::vector;
+
+//
+// Time indexed collision checks of ego trajectories against the traffic.
+//
+// predict() extrapolates every tracked vehicle at constant speed along its
+// lane to a fixed set of time slices. Each slice keeps its vehicles sorted
+// by s. An ego trajectory is given as one Frenet pose per time slice.
+//
+// The broad phase finds, per slice, the vehicles whose s lies within the
+// sum of both bounding radii of the ego s, with two binary searches. The
+// pairs found across all slices are then gathered into flat arrays, and the
+// narrow phase runs an oriented box separating axis test on all of them in
+// one loop without branches, which the compiler vectorizes across time
+// steps.
+//
+// With only a few vehicles the binary searches and the gathering cost more
+// than they save, so up to SMALL_TRAFFIC vehicles every one of them is
+// tested in place, returning at the first overlap.
+//
+// Boxes live in the Frenet frame, yaw is the heading relative to the s
+// axis. The ego box is inflated by a margin along and across its heading,
+// so an overlap means "closer than allowed" rather than touching.
+//
+
+class CollisionChecker {
+ public:
+  // vehicle length and width, and the margins added around the ego box
+  explicit CollisionChecker(double length = 5.0, double width = 2.0,
+                            double margin_s = 0.0, double margin_d = 0.0)
+    : vehicle_half_length_(0.5 * length), vehicle_half_width_(0.5 * width),
+      ego_half_length_(0.5 * length + margin_s), ego_half_width_(0.5 * width + margin_d) {
+    reach_ = sqrt(vehicle_half_length_*vehicle_half_length_ +
+                  vehicle_half_width_*vehicle_half_width_) +
+             sqrt(ego_half_length_*ego_half_length_ + ego_half_width_*ego_half_width_);
+  }
+
+  // Predicts the vehicles of a frame for steps slices dt apart, the first
+  // one t0 seconds after the frame
+  void predict(const SensorFusionFrame &traffic, double t0, double dt, int steps) {
+    vehicles_ = traffic.size();
+    steps_ = steps;
+    dt_ = dt;
+    s_.resize(steps * vehicles_);
+    d_.resize(steps * vehicles_);
+    order_.resize(vehicles_);
+    for (int k = 0; k < steps; ++k) {
+      double t = t0 + k * dt;
+      for (int i = 0; i < vehicles_; ++i) {
+        order_[i] = i;
+      }
+      // vehicles overtake each other, so each slice is sorted on its own
+      std::sort(order_.begin(), order_.end(), [&](int a, int b) {
+        return traffic.s[a] + t * traffic.speed[a] < traffic.s[b] + t * traffic.speed[b];
+      });
+      double *s = &s_[k * vehicles_];
+      double *d = &d_[k * vehicles_];
+      for (int j = 0; j < vehicles_; ++j) {
+        int i = order_[j];
+        s[j] = traffic.s[i] + t * traffic.speed[i];
+        d[j] = traffic.d[i];
+      }
+    }
+  }
+
+  int steps() const { return steps_; }
+  double dt() const { return dt_; }
+
+  // true when the ego at s[k], d[k] with heading yaw[k] in the first n
+  // slices overlaps any vehicle. clearance, if given, receives the smallest
+  // center distance to a vehicle found by the broad phase, or a large
+  // value when there was none.
+  bool collides(const double *s, const double *d, const double *yaw, int n,
+                double *clearance = nullptr) const {
+    n = std::min(n, steps_);
+    if (vehicles_ <= SMALL_TRAFFIC) return collides_small(s, d, yaw, n, clearance);
+    // narrow phase inputs for one chunk of pairs
+    const int chunk = 256;
+    double tx[chunk], ty[chunk], c[chunk], sn[chunk];
+    int m = 0;
+    double closest = 1e9;
+    for (int k = 0; k < n; ++k) {
+      const double *vs = &s_[k * vehicles_];
+      const double *vd = &d_[k * vehicles_];
+      int lo = std::lower_bound(vs, vs + vehicles_, s[k] - reach_) - vs;
+      int hi = std::upper_bound(vs + lo, vs + vehicles_, s[k] + reach_) - vs;
+      if (lo == hi) continue;
+      double cos_yaw = cos(yaw[k]);
+      double sin_yaw = sin(yaw[k]);
+      for (int j = lo; j < hi; ++j) {
+        tx[m] = vs[j] - s[k];
+        ty[m] = vd[j] - d[k];
+        c[m] = cos_yaw;
+        sn[m] = sin_yaw;
+        if (++m == chunk) {
+          if (overlap(tx, ty, c, sn, m, closest)) return report(true, closest, clearance);
+          m = 0;
+        }
+      }
+    }
+    bool hit = overlap(tx, ty, c, sn, m, closest);
+    return report(hit, closest, clearance);
+  }
+
+ private:
+  // vehicles up to which collides() skips the broad phase
+  static const int SMALL_TRAFFIC = 16;
+
+  double vehicle_half_length_;
+  double vehicle_half_width_;
+  double ego_half_length_;
+  double ego_half_width_;
+  // largest center distance at which two boxes can touch
+  double reach_;
+
+  int vehicles_ = 0;
+  int steps_ = 0;
+  double dt_ = 0.0;
+  // per slice, vehicle positions sorted by s
+  vector<double> s_;
+  vector<double> d_;
+  vector<int> order_;
+
+  static bool report(bool hit, double closest, double *clearance) {
+    if (clearance) *clearance = closest;
+    return hit;
+  }
+
+  // collides() for a few vehicles: the same reach and test, pair by pair
+  bool collides_small(const double *s, const double *d, const double *yaw, int n,
+                      double *clearance) const {
+    double closest = 1e9;
+    for (int k = 0; k < n; ++k) {
+      const double *vs = &s_[k * vehicles_];
+      const double *vd = &d_[k * vehicles_];
+      for (int j = 0; j < vehicles_; ++j) {
+        double tx = vs[j] - s[k];
+        if (fabs(tx) > reach_) continue;
+        double ty = vd[j] - d[k];
+        double c = cos(yaw[k]);
+        double sn = sin(yaw[k]);
+        if (overlap(&tx, &ty, &c, &sn, 1, closest)) return report(true, closest, clearance);
+      }
+    }
+    return report(false, closest, clearance);
+  }
+
+  // separating axis test of the ego box, heading (c, sn), against a vehicle
+  // box aligned with the s axis at offset (tx, ty), for m pairs
+  bool overlap(const double *tx, const double *ty, const double *c, const double *sn,
+               int m, double &closest) const {
+    const double el = ego_half_length_;
+    const double ew = ego_half_width_;
+    const double vl = vehicle_half_length_;
+    const double vw = vehicle_half_width_;
+    int hits = 0;
+    double dist_sq = closest * closest;
+    for (int p = 0; p < m; ++p) {
+      double ac = fabs(c[p]);
+      double as = fabs(sn[p]);
+      // vehicle axes, s and d
+      bool sep = fabs(tx[p]) > vl + el*ac + ew*as;
+      sep |= fabs(ty[p]) > vw + el*as + ew*ac;
+      // ego axes, along and across its heading
+      sep |= fabs(tx[p]*c[p] + ty[p]*sn[p]) > el + vl*ac + vw*as;
+      sep |= fabs(ty[p]*c[p] - tx[p]*sn[p]) > ew + vl*as + vw*ac;
+      hits += !sep;
+      dist_sq = std::min(dist_sq, tx[p]*tx[p] + ty[p]*ty[p]);
+    }
+    closest = sqrt(dist_sq);
+    return hits > 0;
+  }
+};
+
+#endif  // COLLISION_H
@@ -0,0 +1,207 @@
+#ifndef FRENET_BATCH_H
+#define FRENET_BATCH_H
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRENET_BATCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+//
+// Batched kernels behind the array versions of ReferenceLine::getXY and
+// Map::getFrenet.
+//
+// Each kernel has a portable scalar version and, on x86 with GCC or clang,
+// an AVX2 version that handles four points per iteration. The AVX2 code is
+// compiled for that target only, and the version used is picked at runtime
+// from the CPU, so the binary still runs on machines without AVX2.
+//
+
+namespace frenet_batch {
+
+// true when the AVX2 kernels can run on this CPU
+inline bool use_avx2() {
+#ifdef FRENET_BATCH_AVX2
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// Reference line lookup: table holds x, y, nx, ny per sample
+inline void reference_xy_scalar(const double *table, double max_s, double inv_resolution,
+                                const double *s, const double *d, int n,
+                                double *x, double *y) {
+  for (int k = 0; k < n; ++k) {
+    double sk = s[k] - floor(s[k] / max_s) * max_s;
+    // rounding can leave s just outside [0, max_s), as in the AVX2 kernel
+    if (sk < 0.0) sk = 0.0;
+    double pos = sk * inv_resolution;
+    int i = (int)pos;
+    double t = pos - i;
+    const double *a = table + 4*i;
+    const double *b = a + 4;
+    double nx = a[2] + t*(b[2] - a[2]);
+    double ny = a[3] + t*(b[3] - a[3]);
+    x[k] = a[0] + t*(b[0] - a[0]) + d[k]*nx;
+    y[k] = a[1] + t*(b[1] - a[1]) + d[k]*ny;
+  }
+}
+
+// Projection of points onto their map segment, prev/next are the waypoint
+// indices of the segment each point belongs to
+inline void project_scalar(const double *maps_x, const double *maps_y, const double *maps_s,
+                           const int *prev, const int *next,
+                           const double *x, const double *y, int n,
+                           double *s, double *d) {
+  for (int k = 0; k < n; ++k) {
+    double px = maps_x[prev[k]];
+    double py = maps_y[prev[k]];
+    double n_x = maps_x[next[k]] - px;
+    double n_y = maps_y[next[k]] - py;
+    double x_x = x[k] - px;
+    double x_y = y[k] - py;
+    // find the projection of x onto n
+    double proj_norm = (x_x*n_x + x_y*n_y) / (n_x*n_x + n_y*n_y);
+    double proj_x = proj_norm*n_x;
+    double proj_y = proj_norm*n_y;
+    double frenet_d = sqrt((x_x-proj_x)*(x_x-proj_x) + (x_y-proj_y)*(x_y-proj_y));
+    // d is negative when the point is closer to the center point than its projection
+    double center_x = 1000 - px;
+    double center_y = 2000 - py;
+    double to_pos = (center_x-x_x)*(center_x-x_x) + (center_y-x_y)*(center_y-x_y);
+    double to_ref = (center_x-proj_x)*(center_x-proj_x) + (center_y-proj_y)*(center_y-proj_y);
+    d[k] = (to_pos <= to_ref) ? -frenet_d : frenet_d;
+    s[k] = maps_s[prev[k]] + sqrt(proj_x*proj_x + proj_y*proj_y);
+  }
+}
+
+#ifdef FRENET_BATCH_AVX2
+
+// loads base[idx[0..3]]; the masked form starts from zeros instead of an
+// undefined register
+__attribute__((target("avx2")))
+inline __m256d gather(const double *base, __m128i idx) {
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, idx, all, 8);
+}
+
+__attribute__((target("avx2")))
+inline void reference_xy_avx2(const double *table, double max_s, double inv_resolution,
+                              const double *s, const double *d, int n,
+                              double *x, double *y) {
+  const __m256d v_max_s = _mm256_set1_pd(max_s);
+  const __m256d v_inv_max_s = _mm256_set1_pd(1.0 / max_s);
+  const __m256d v_inv_res = _mm256_set1_pd(inv_resolution);
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m256d vs = _mm256_loadu_pd(s + k);
+    __m256d vd = _mm256_loadu_pd(d + k);
+    // wrap s around the loop
+    __m256d laps = _mm256_floor_pd(_mm256_mul_pd(vs, v_inv_max_s));
+    vs = _mm256_sub_pd(vs, _mm256_mul_pd(laps, v_max_s));
+    // rounding can leave s just outside [0, max_s)
+    vs = _mm256_max_pd(vs, _mm256_setzero_pd());
+    __m256d pos = _mm256_mul_pd(vs, v_inv_res);
+    __m256d fl = _mm256_floor_pd(pos);
+    __m256d t = _mm256_sub_pd(pos, fl);
+    // offset of each sample's x in the table, 4 values per sample
+    __m128i idx = _mm_slli_epi32(_mm256_cvttpd_epi32(fl), 2);
+    __m128i idx_b = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    __m256d ax = gather(table, idx);
+    __m256d ay = gather(table + 1, idx);
+    __m256d anx = gather(table + 2, idx);
+    __m256d any = gather(table + 3, idx);
+    __m256d bx = gather(table, idx_b);
+    __m256d by = gather(table + 1, idx_b);
+    __m256d bnx = gather(table + 2, idx_b);
+    __m256d bny = gather(table + 3, idx_b);
+    __m256d px = _mm256_add_pd(ax, _mm256_mul_pd(t, _mm256_sub_pd(bx, ax)));
+    __m256d py = _mm256_add_pd(ay, _mm256_mul_pd(t, _mm256_sub_pd(by, ay)));
+    __m256d nx = _mm256_add_pd(anx, _mm256_mul_pd(t, _mm256_sub_pd(bnx, anx)));
+    __m256d ny = _mm256_add_pd(any, _mm256_mul_pd(t, _mm256_sub_pd(bny, any)));
+    _mm256_storeu_pd(x + k, _mm256_add_pd(px, _mm256_mul_pd(vd, nx)));
+    _mm256_storeu_pd(y + k, _mm256_add_pd(py, _mm256_mul_pd(vd, ny)));
+  }
+  reference_xy_scalar(table, max_s, inv_resolution, s + k, d + k, n - k, x + k, y + k);
+}
+
+__attribute__((target("avx2")))
+inline void project_avx2(const double *maps_x, const double *maps_y, const double *maps_s,
+                         const int *prev, const int *next,
+                         const double *x, const double *y, int n,
+                         double *s, double *d) {
+  const __m256d c1000 = _mm256_set1_pd(1000.0);
+  const __m256d c2000 = _mm256_set1_pd(2000.0);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128i ip = _mm_loadu_si128((const __m128i *)(prev + k));
+    __m128i in = _mm_loadu_si128((const __m128i *)(next + k));
+    __m256d px = gather(maps_x, ip);
+    __m256d py = gather(maps_y, ip);
+    __m256d ps = gather(maps_s, ip);
+    __m256d n_x = _mm256_sub_pd(gather(maps_x, in), px);
+    __m256d n_y = _mm256_sub_pd(gather(maps_y, in), py);
+    __m256d x_x = _mm256_sub_pd(_mm256_loadu_pd(x + k), px);
+    __m256d x_y = _mm256_sub_pd(_mm256_loadu_pd(y + k), py);
+    // find the projection of x onto n
+    __m256d dot = _mm256_add_pd(_mm256_mul_pd(x_x, n_x), _mm256_mul_pd(x_y, n_y));
+    __m256d len_sq = _mm256_add_pd(_mm256_mul_pd(n_x, n_x), _mm256_mul_pd(n_y, n_y));
+    __m256d proj_norm = _mm256_div_pd(dot, len_sq);
+    __m256d proj_x = _mm256_mul_pd(proj_norm, n_x);
+    __m256d proj_y = _mm256_mul_pd(proj_norm, n_y);
+    __m256d e_x = _mm256_sub_pd(x_x, proj_x);
+    __m256d e_y = _mm256_sub_pd(x_y, proj_y);
+    __m256d frenet_d = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(e_x, e_x), _mm256_mul_pd(e_y, e_y)));
+    // d is negative when the point is closer to the center point than its projection
+    __m256d center_x = _mm256_sub_pd(c1000, px);
+    __m256d center_y = _mm256_sub_pd(c2000, py);
+    __m256d a_x = _mm256_sub_pd(center_x, x_x);
+    __m256d a_y = _mm256_sub_pd(center_y, x_y);
+    __m256d b_x = _mm256_sub_pd(center_x, proj_x);
+    __m256d b_y = _mm256_sub_pd(center_y, proj_y);
+    __m256d to_pos = _mm256_add_pd(_mm256_mul_pd(a_x, a_x), _mm256_mul_pd(a_y, a_y));
+    __m256d to_ref = _mm256_add_pd(_mm256_mul_pd(b_x, b_x), _mm256_mul_pd(b_y, b_y));
+    __m256d negative = _mm256_cmp_pd(to_pos, to_ref, _CMP_LE_OQ);
+    frenet_d = _mm256_xor_pd(frenet_d, _mm256_and_pd(negative, sign));
+    __m256d proj_len = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(proj_x, proj_x),
+                                                    _mm256_mul_pd(proj_y, proj_y)));
+    _mm256_storeu_pd(d + k, frenet_d);
+    _mm256_storeu_pd(s + k, _mm256_add_pd(ps, proj_len));
+  }
+  project_scalar(maps_x, maps_y, maps_s, prev + k, next + k, x + k, y + k, n - k, s + k, d + k);
+}
+
+#endif  // FRENET_BATCH_AVX2
+
+inline void reference_xy(const double *table, double max_s, double inv_resolution,
+                         const double *s, const double *d, int n,
+                         double *x, double *y) {
+#ifdef FRENET_BATCH_AVX2
+  if (use_avx2()) {
+    reference_xy_avx2(table, max_s, inv_resolution, s, d, n, x, y);
+    return;
+  }
+#endif
+  reference_xy_scalar(table, max_s, inv_resolution, s, d, n, x, y);
+}
+
+inline void project(const double *maps_x, const double *maps_y, const double *maps_s,
+                    const int *prev, const int *next,
+                    const double *x, const double *y, int n,
+                    double *s, double *d) {
+#ifdef FRENET_BATCH_AVX2
+  if (use_avx2()) {
+    project_avx2(maps_x, maps_y, maps_s, prev, next, x, y, n, s, d);
+    return;
+  }
+#endif
+  project_scalar(maps_x, maps_y, maps_s, prev, next, x, y, n, s, d);
+}
+
+}  // namespace frenet_batch
+
+#endif  // FRENET_BATCH_H
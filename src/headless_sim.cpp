@@ -0,0 +1,536 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef HEADLESS_SIM_WEBSOCKET
+#include <uWS/uWS.h>
+#endif
+#include "helpers.h"
+#include "map.h"
+#include "map_file.h"
+#include "map_tiles.h"
+#include "planner_server.h"
+#include "reference_line.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Headless stand-in for the simulator, to load test the planner without
+// Unity.
+//
+// Every simulated world has an ego that drives along the path of the last
+// control message, one point per 20ms tick, and traffic cars that follow
+// their lane, slow down behind slower cars and change lanes at random when
+// the target lane is free. A world sends the same 42["telemetry",...] frame
+// the simulator sends, waits for the reply and then advances a fixed number
+// of ticks, so the planner always sees a previous path consumed as with a
+// fixed latency. Nothing waits for the wall clock: worlds run as fast as the
+// planner answers.
+//
+// By default the worlds talk to a PlannerServer in the same process, which
+// needs no websocket library. Built with HEADLESS_SIM_WEBSOCKET, -u connects
+// every world to a running path_planning over its own websocket instead.
+//
+// usage: headless_sim [-n worlds] [-c cars] [-t cycles] [-k ticks] [-l changes]
+//                     [-r seed] [-s shards] [-w workers] [-u ws://host:port] <map.csv>
+//
+//   map.csv  the simulator's waypoint csv, e.g. data/highway_map.csv
+//   -n  simulated worlds, one planner session each, defaults to 1
+//   -c  traffic cars per world, defaults to 12
+//   -t  planning cycles per world, defaults to 1000
+//   -k  20ms ticks simulated per cycle, defaults to 3
+//   -l  lane changes per car and minute, defaults to 2
+//   -r  random seed, defaults to 1
+//   -s  -w  planning shards and workers of the in process server, as for
+//       path_planning
+//   -u  websocket url of a running path_planning
+//
+
+struct SimOptions {
+  int worlds = 1;
+  int cars = 12;
+  int cycles = 1000;
+  int ticks = 3;
+  double lane_changes = 2.0;
+  unsigned seed = 1;
+  int shards = 0;
+  int pool_threads = 0;
+  string url;
+  string map_file;
+};
+
+struct TrafficCar {
+  double s;
+  double d;
+  double speed;          // [m/s]
+  double desired_speed;  // [m/s]
+  int lane;
+  // counts a collision once per contact
+  bool touching;
+};
+
+class HighwaySim {
+ public:
+  HighwaySim(const Map &map, const SimOptions &options, unsigned seed)
+    : map_(map), options_(options), rng_(seed) {
+    // where the simulator starts the ego
+    x_ = 909.48;
+    y_ = 1128.67;
+    s_ = 124.8336;
+    d_ = 6.164833;
+    std::uniform_real_distribution<double> offset(-50.0, 250.0);
+    std::uniform_real_distribution<double> speed(15.0, 22.0);
+    std::uniform_int_distribution<int> lane(0, 2);
+    for (int i = 0; i < options.cars; ++i) {
+      TrafficCar car;
+      car.lane = lane(rng_);
+      car.d = 2 + 4*car.lane;
+      car.desired_speed = speed(rng_);
+      car.speed = car.desired_speed;
+      car.touching = false;
+      // keep spawned cars apart, and away from the ego
+      for (int tries = 0; tries < 100; ++tries) {
+        car.s = wrap_s(s_ + offset(rng_));
+        bool free = fabs(ds(car.s, s_)) > 15.0;
+        for (size_t j = 0; j < cars_.size() && free; ++j) {
+          free = cars_[j].lane != car.lane || fabs(ds(car.s, cars_[j].s)) > 12.0;
+        }
+        if (free) break;
+      }
+      cars_.push_back(car);
+    }
+  }
+
+  int cycles() const { return cycles_; }
+  int collisions() const { return collisions_; }
+  double distance() const { return distance_; }
+  double time() const { return time_; }
+
+  /*
+  * writes the telemetry frame of the current state
+  */
+  void telemetry(string &frame) {
+    frame.clear();
+    frame += "42[\"telemetry\",{\"x\":";
+    append_number(frame, x_);
+    frame += ",\"y\":";
+    append_number(frame, y_);
+    frame += ",\"yaw\":";
+    append_number(frame, rad2deg(yaw_));
+    frame += ",\"speed\":";
+    append_number(frame, speed_*2.24);
+    frame += ",\"s\":";
+    append_number(frame, s_);
+    frame += ",\"d\":";
+    append_number(frame, d_);
+    // the points of the last path not driven yet
+    frame += ",\"previous_path_x\":[";
+    for (size_t i = next_; i < path_x_.size(); ++i) {
+      if (i > next_) frame += ',';
+      append_number(frame, path_x_[i]);
+    }
+    frame += "],\"previous_path_y\":[";
+    for (size_t i = next_; i < path_y_.size(); ++i) {
+      if (i > next_) frame += ',';
+      append_number(frame, path_y_[i]);
+    }
+    frame += "],\"end_path_s\":";
+    double end_s = 0.0;
+    double end_d = 0.0;
+    size_t n = path_x_.size();
+    if (n > next_) {
+      double theta = (n >= 2) ? atan2(path_y_[n-1] - path_y_[n-2], path_x_[n-1] - path_x_[n-2])
+                              : yaw_;
+      vector<double> frenet = map_.getFrenet(path_x_[n-1], path_y_[n-1], theta);
+      end_s = frenet[0];
+      end_d = frenet[1];
+    }
+    append_number(frame, end_s);
+    frame += ",\"end_path_d\":";
+    append_number(frame, end_d);
+    frame += ",\"sensor_fusion\":[";
+    for (size_t i = 0; i < cars_.size(); ++i) {
+      const TrafficCar &car = cars_[i];
+      vector<double> xy = map_.getXY(car.s, car.d);
+      vector<double> ahead = map_.getXY(car.s + 1.0, car.d);
+      double heading = atan2(ahead[1] - xy[1], ahead[0] - xy[0]);
+      if (i > 0) frame += ',';
+      frame += '[';
+      append_number(frame, i);
+      frame += ',';
+      append_number(frame, xy[0]);
+      frame += ',';
+      append_number(frame, xy[1]);
+      frame += ',';
+      append_number(frame, car.speed*cos(heading));
+      frame += ',';
+      append_number(frame, car.speed*sin(heading));
+      frame += ',';
+      append_number(frame, car.s);
+      frame += ',';
+      append_number(frame, car.d);
+      frame += ']';
+    }
+    frame += "]}]";
+  }
+
+  /*
+  * takes the path of a control message, returns false for any other message
+  */
+  bool control(const string &message) {
+    if (message.compare(0, 12, "42[\"control\"") != 0) return false;
+    if (!parse_array(message, "\"next_x\":[", path_x_) ||
+        !parse_array(message, "\"next_y\":[", path_y_) ||
+        path_x_.size() != path_y_.size()) {
+      return false;
+    }
+    next_ = 0;
+    ++cycles_;
+    return true;
+  }
+
+  /*
+  * advances the world by ticks steps of 20ms
+  */
+  void step(int ticks) {
+    const double dt = 0.02;
+    for (int k = 0; k < ticks; ++k) {
+      // the ego jumps to the next path point, and stands still without one
+      if (next_ < path_x_.size()) {
+        double dx = path_x_[next_] - x_;
+        double dy = path_y_[next_] - y_;
+        double dist = sqrt(dx*dx + dy*dy);
+        if (dist > 1e-3) yaw_ = atan2(dy, dx);
+        x_ = path_x_[next_];
+        y_ = path_y_[next_];
+        ++next_;
+        speed_ = dist / dt;
+        distance_ += dist;
+      } else {
+        speed_ = 0.0;
+      }
+      vector<double> frenet = map_.getFrenet(x_, y_, yaw_);
+      s_ = frenet[0];
+      d_ = frenet[1];
+      move_traffic(dt);
+      time_ += dt;
+    }
+  }
+
+ private:
+  const Map &map_;
+  const SimOptions &options_;
+  std::mt19937 rng_;
+
+  // ego
+  double x_;
+  double y_;
+  double s_;
+  double d_;
+  double yaw_ = 0.0;
+  double speed_ = 0.0;
+  // path of the last control message, points before next_ are driven
+  vector<double> path_x_;
+  vector<double> path_y_;
+  size_t next_ = 0;
+
+  vector<TrafficCar> cars_;
+
+  int cycles_ = 0;
+  int collisions_ = 0;
+  double distance_ = 0.0;
+  double time_ = 0.0;
+
+  double wrap_s(double s) const {
+    s = fmod(s, map_.max_s());
+    return (s < 0) ? s + map_.max_s() : s;
+  }
+
+  // signed distance along the loop from b to a
+  double ds(double a, double b) const {
+    double diff = wrap_s(a - b);
+    return (diff > 0.5*map_.max_s()) ? diff - map_.max_s() : diff;
+  }
+
+  void move_traffic(double dt) {
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    double change_probability = options_.lane_changes / 60.0 * dt;
+    for (size_t i = 0; i < cars_.size(); ++i) {
+      TrafficCar &car = cars_[i];
+      // closest vehicle ahead in the lane, the ego included
+      double gap = 1e9;
+      double leader_speed = car.desired_speed;
+      if (fabs(d_ - car.d) < 2.0 && ds(s_, car.s) > 0 && ds(s_, car.s) < gap) {
+        gap = ds(s_, car.s);
+        leader_speed = speed_;
+      }
+      for (size_t j = 0; j < cars_.size(); ++j) {
+        double ahead = ds(cars_[j].s, car.s);
+        if (j != i && fabs(cars_[j].d - car.d) < 2.0 && ahead > 0 && ahead < gap) {
+          gap = ahead;
+          leader_speed = cars_[j].speed;
+        }
+      }
+      double target = car.desired_speed;
+      if (gap < 20.0 + car.speed) {
+        target = std::min(target, (gap < 10.0) ? leader_speed - 2.0 : leader_speed);
+      }
+      double accel = std::max(std::min(target - car.speed, 3.0*dt), -5.0*dt);
+      car.speed = std::max(car.speed + accel, 0.0);
+      car.s = wrap_s(car.s + car.speed*dt);
+
+      // lane changes start from the lane center, towards a free lane
+      double center = 2 + 4*car.lane;
+      if (fabs(car.d - center) < 0.1 && chance(rng_) < change_probability) {
+        int lane = car.lane + ((chance(rng_) < 0.5) ? -1 : 1);
+        if (lane < 0 || lane > 2) lane = 2*car.lane - lane;
+        bool free = fabs(d_ - (2 + 4*lane)) > 2.0 || fabs(ds(s_, car.s)) > 15.0;
+        for (size_t j = 0; j < cars_.size() && free; ++j) {
+          free = j == i || cars_[j].lane != lane || fabs(ds(cars_[j].s, car.s)) > 15.0;
+        }
+        if (free) car.lane = lane;
+        center = 2 + 4*car.lane;
+      }
+      double lateral = 2.0*dt;
+      car.d += std::max(std::min(center - car.d, lateral), -lateral);
+
+      // vehicle boxes of 5m by 2m
+      bool touching = fabs(ds(car.s, s_)) < 5.0 && fabs(car.d - d_) < 2.0;
+      if (touching && !car.touching) ++collisions_;
+      car.touching = touching;
+    }
+  }
+
+  static void append_number(string &frame, double value) {
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%.10g", value);
+    frame.append(buffer, n);
+  }
+
+  // reads the numbers of the array that follows key
+  static bool parse_array(const string &message, const char *key, vector<double> &values) {
+    values.clear();
+    size_t start = message.find(key);
+    if (start == string::npos) return false;
+    const char *p = message.c_str() + start + strlen(key);
+    while (*p && *p != ']') {
+      char *end;
+      double value = strtod(p, &end);
+      if (end == p) return false;
+      values.push_back(value);
+      p = end;
+      while (*p == ',' || *p == ' ') ++p;
+    }
+    return *p == ']';
+  }
+};
+
+/*
+* parses the options and the map file, returns false on unknown or malformed
+* options, or without a map file
+*/
+bool parse_options(int argc, char *argv[], SimOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.size() != 2 || arg[0] != '-') {
+      options.map_file = arg;
+      continue;
+    }
+    if (i + 1 >= argc) return false;
+    string value = argv[++i];
+    if (arg == "-n") {
+      options.worlds = atoi(value.c_str());
+    } else if (arg == "-c") {
+      options.cars = atoi(value.c_str());
+    } else if (arg == "-t") {
+      options.cycles = atoi(value.c_str());
+    } else if (arg == "-k") {
+      options.ticks = atoi(value.c_str());
+    } else if (arg == "-l") {
+      options.lane_changes = atof(value.c_str());
+    } else if (arg == "-r") {
+      options.seed = atoi(value.c_str());
+    } else if (arg == "-s") {
+      options.shards = atoi(value.c_str());
+    } else if (arg == "-w") {
+      options.pool_threads = atoi(value.c_str());
+    } else if (arg == "-u") {
+      options.url = value;
+    } else {
+      return false;
+    }
+  }
+  return !options.map_file.empty() && options.worlds > 0 && options.cars >= 0 && options.cycles > 0 && options.ticks > 0;
+}
+
+/*
+* runs every world against a planner server in this process, in lock step:
+* all worlds send their telemetry, then each one applies its reply
+*/
+void run_in_process(const SimOptions &options, const ReferenceLine &reference_line,
+                    vector<std::unique_ptr<HighwaySim> > &worlds) {
+  TiledMap tiled_map;
+  // one shard per hardware thread unless given
+  int shards = (options.shards > 0) ? options.shards
+                                    : std::max((int)std::thread::hardware_concurrency(), 1);
+  // the shards count the replies of the cycle, the sim sleeps until all
+  // worlds have theirs
+  std::mutex reply_mutex;
+  std::condition_variable reply_cond;
+  size_t replies = 0;
+  PlannerServer server(reference_line, tiled_map, shards, options.pool_threads, [&] {
+    {
+      std::lock_guard<std::mutex> lock(reply_mutex);
+      ++replies;
+    }
+    reply_cond.notify_one();
+  });
+  vector<std::shared_ptr<PlannerSession> > sessions;
+  for (size_t i = 0; i < worlds.size(); ++i) {
+    sessions.push_back(server.open());
+  }
+  for (int cycle = 0; cycle < options.cycles; ++cycle) {
+    for (size_t i = 0; i < worlds.size(); ++i) {
+      worlds[i]->telemetry(sessions[i]->inbox.back());
+      sessions[i]->inbox.publish();
+      server.notify(*sessions[i]);
+    }
+    {
+      std::unique_lock<std::mutex> lock(reply_mutex);
+      reply_cond.wait(lock, [&] { return replies == worlds.size(); });
+      replies = 0;
+    }
+    for (size_t i = 0; i < worlds.size(); ++i) {
+      Mailbox<string> &outbox = sessions[i]->outbox;
+      if (outbox.take()) worlds[i]->control(outbox.front());
+      worlds[i]->step(options.ticks);
+    }
+  }
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    server.close(sessions[i]);
+  }
+}
+
+#ifdef HEADLESS_SIM_WEBSOCKET
+/*
+* runs every world over its own websocket to a running path_planning, each
+* world sends its next frame as soon as the reply to the last one is in
+*/
+bool run_websocket(const SimOptions &options, vector<std::unique_ptr<HighwaySim> > &worlds) {
+  uWS::Hub h;
+  size_t connected = 0;
+  bool failed = false;
+  string frame;
+  string message;
+
+  h.onConnection([&](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+    HighwaySim *world = worlds[connected++].get();
+    ws.setUserData(world);
+    world->telemetry(frame);
+    ws.send(frame.data(), frame.length(), uWS::OpCode::TEXT);
+  });
+
+  h.onMessage([&](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length,
+                  uWS::OpCode opCode) {
+    HighwaySim *world = (HighwaySim *)ws.getUserData();
+    message.assign(data, length);
+    if (!world->control(message)) return;
+    world->step(options.ticks);
+    if (world->cycles() >= options.cycles) {
+      ws.close();
+      return;
+    }
+    world->telemetry(frame);
+    ws.send(frame.data(), frame.length(), uWS::OpCode::TEXT);
+  });
+
+  h.onError([&](void *user) {
+    std::cerr << "Failed to connect to " << options.url << std::endl;
+    failed = true;
+  });
+
+  for (size_t i = 0; i < worlds.size(); ++i) {
+    h.connect(options.url, nullptr);
+  }
+  h.run();
+  return !failed;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  SimOptions options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr << "usage: headless_sim [-n worlds] [-c cars] [-t cycles] [-k ticks]"
+              << " [-l changes] [-r seed] [-s shards] [-w workers] [-u ws://host:port]"
+              << " <map.csv>" << std::endl;
+    return -1;
+  }
+#ifndef HEADLESS_SIM_WEBSOCKET
+  if (!options.url.empty()) {
+    std::cerr << "Built without websocket support, -u is not available" << std::endl;
+    return -1;
+  }
+#endif
+
+  vector<double> map_waypoints_x;
+  vector<double> map_waypoints_y;
+  vector<double> map_waypoints_s;
+  vector<double> map_waypoints_dx;
+  vector<double> map_waypoints_dy;
+  if (!load_map_csv(options.map_file, map_waypoints_x, map_waypoints_y, map_waypoints_s,
+                    map_waypoints_dx, map_waypoints_dy) || map_waypoints_x.size() < 3) {
+    std::cerr << "Failed to read waypoints from " << options.map_file << std::endl;
+    return -1;
+  }
+  // The max s value before wrapping around the track back to 0
+  double max_s = loop_length(map_waypoints_x, map_waypoints_y, map_waypoints_s);
+  Map map(map_waypoints_x, map_waypoints_y, map_waypoints_s,
+          map_waypoints_dx, map_waypoints_dy, max_s);
+
+  vector<std::unique_ptr<HighwaySim> > worlds;
+  for (int i = 0; i < options.worlds; ++i) {
+    worlds.push_back(std::unique_ptr<HighwaySim>(new HighwaySim(map, options, options.seed + i)));
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (options.url.empty()) {
+    // sampled every 0.5m
+    ReferenceLine reference_line(map, 0.5);
+    start = std::chrono::steady_clock::now();
+    run_in_process(options, reference_line, worlds);
+  } else {
+#ifdef HEADLESS_SIM_WEBSOCKET
+    if (!run_websocket(options, worlds)) return -1;
+#endif
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int cycles = 0;
+  int collisions = 0;
+  double distance = 0.0;
+  double time = 0.0;
+  for (size_t i = 0; i < worlds.size(); ++i) {
+    cycles += worlds[i]->cycles();
+    collisions += worlds[i]->collisions();
+    distance += worlds[i]->distance();
+    time += worlds[i]->time();
+  }
+  std::cout << "Simulated " << worlds.size() << " worlds for " << cycles << " planning cycles"
+            << " in " << wall << " s: " << cycles / wall << " cycles/s, "
+            << time / wall << "x real time" << std::endl;
+  std::cout << "Mean ego speed " << ((time > 0) ? distance / time * 2.24 : 0.0) << " mph, "
+            << collisions << " collisions" << std::endl;
+  return 0;
+}
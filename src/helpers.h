@@ -4,6 +4,7 @@
 #include <math.h>
 #include <string>
 #include <vector>
+#include "waypoint_grid.h"
 
 // for convenience
 using std::string;
@@ -40,12 +41,19 @@ double distance(double x1, double y1, double x2, double y2) {
 }
 
 // Calculate closest waypoint to current x, y position
+// If a spatial index over the waypoints is given it is used instead of
+//   scanning every waypoint
 int ClosestWaypoint(double x, double y, const vector<double> &maps_x, 
-                    const vector<double> &maps_y) {
+                    const vector<double> &maps_y,
+                    const WaypointGrid *grid = nullptr) {
+  if (grid) {
+    return grid->closest_waypoint(x,y);
+  }
+
   double closestLen = 100000; //large number
   int closestWaypoint = 0;
 
-  for (int i = 0; i < maps_x.size(); ++i) {
+  for (int i = 0; i < (int)maps_x.size(); ++i) {
     double map_x = maps_x[i];
     double map_y = maps_y[i];
     double dist = distance(x,y,map_x,map_y);
@@ -60,8 +68,9 @@ int ClosestWaypoint(double x, double y, const vector<double> &maps_x,
 
 // Returns next waypoint of the closest waypoint
 int NextWaypoint(double x, double y, double theta, const vector<double> &maps_x, 
-                 const vector<double> &maps_y) {
-  int closestWaypoint = ClosestWaypoint(x,y,maps_x,maps_y);
+                 const vector<double> &maps_y,
+                 const WaypointGrid *grid = nullptr) {
+  int closestWaypoint = ClosestWaypoint(x,y,maps_x,maps_y,grid);
 
   double map_x = maps_x[closestWaypoint];
   double map_y = maps_y[closestWaypoint];
@@ -73,7 +82,7 @@ int NextWaypoint(double x, double y, double theta, const vector<double> &maps_x,
 
   if (angle > pi()/2) {
     ++closestWaypoint;
-    if (closestWaypoint == maps_x.size()) {
+    if (closestWaypoint == (int)maps_x.size()) {
       closestWaypoint = 0;
     }
   }
@@ -84,8 +93,9 @@ int NextWaypoint(double x, double y, double theta, const vector<double> &maps_x,
 // Transform from Cartesian x,y coordinates to Frenet s,d coordinates
 vector<double> getFrenet(double x, double y, double theta, 
                          const vector<double> &maps_x, 
-                         const vector<double> &maps_y) {
-  int next_wp = NextWaypoint(x,y, theta, maps_x,maps_y);
+                         const vector<double> &maps_y,
+                         const WaypointGrid *grid = nullptr) {
+  int next_wp = NextWaypoint(x,y, theta, maps_x,maps_y,grid);
 
   int prev_wp;
   prev_wp = next_wp-1;
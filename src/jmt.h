@@ -0,0 +1,131 @@
+#ifndef JMT_H
+#define JMT_H
+
+#include <algorithm>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/LU>
+
+// for convenience
+using std::vector;
+
+//
+// Jerk minimizing trajectories.
+//
+// A jerk minimizing trajectory from a start to an end state over a horizon
+// T is the quintic p(t) = c0 + c1 t + ... + c5 t^5. The start state fixes
+// c0, c1 and c2. The other three coefficients solve a 3x3 system whose
+// matrix depends only on T. A JmtSolver inverts that matrix once for its
+// horizon. After that each trajectory costs one 3x3 matrix-vector product.
+// The batch version puts up to 64 end conditions side by side and
+// multiplies them in one fixed-size Eigen product, which vectorizes. The
+// same solver handles s(t) and d(t), the two only differ in their states.
+//
+
+// Position, velocity and acceleration along one axis
+struct JmtState {
+  double p;
+  double v;
+  double a;
+};
+
+// Quintic polynomial p(t) = c[0] + c[1] t + ... + c[5] t^5
+struct Quintic {
+  double c[6];
+
+  double position(double t) const {
+    return c[0] + t*(c[1] + t*(c[2] + t*(c[3] + t*(c[4] + t*c[5]))));
+  }
+  double velocity(double t) const {
+    return c[1] + t*(2*c[2] + t*(3*c[3] + t*(4*c[4] + t*5*c[5])));
+  }
+  double acceleration(double t) const {
+    return 2*c[2] + t*(6*c[3] + t*(12*c[4] + t*20*c[5]));
+  }
+  double jerk(double t) const {
+    return 6*c[3] + t*(24*c[4] + t*60*c[5]);
+  }
+};
+
+class JmtSolver {
+ public:
+  JmtSolver() : JmtSolver(1.0) {}
+
+  explicit JmtSolver(double T) : T_(T) {
+    double T2 = T*T;
+    double T3 = T2*T;
+    double T4 = T3*T;
+    double T5 = T4*T;
+    Eigen::Matrix3d A;
+    A << T3,    T4,     T5,
+         3*T2,  4*T3,   5*T4,
+         6*T,   12*T2,  20*T3;
+    inverse_ = A.inverse();
+  }
+
+  double horizon() const { return T_; }
+
+  Quintic solve(const JmtState &start, const JmtState &end) const {
+    Eigen::Vector3d b = residual(start, end);
+    Eigen::Vector3d x = inverse_ * b;
+    Quintic q = {{start.p, start.v, 0.5*start.a, x(0), x(1), x(2)}};
+    return q;
+  }
+
+  // Solves n trajectories, start[k] to end[k], into out[k]
+  void solve(const JmtState *start, const JmtState *end, int n, Quintic *out) const {
+    const int chunk = 64;
+    // unused columns of a partial chunk are zero or left over from the last one
+    Eigen::Matrix<double, 3, chunk> b = Eigen::Matrix<double, 3, chunk>::Zero();
+    Eigen::Matrix<double, 3, chunk> x;
+    for (int k0 = 0; k0 < n; k0 += chunk) {
+      int m = std::min(chunk, n - k0);
+      for (int k = 0; k < m; ++k) {
+        b.col(k) = residual(start[k0+k], end[k0+k]);
+      }
+      x.noalias() = inverse_ * b;
+      for (int k = 0; k < m; ++k) {
+        const JmtState &s = start[k0+k];
+        Quintic &q = out[k0+k];
+        q.c[0] = s.p;
+        q.c[1] = s.v;
+        q.c[2] = 0.5*s.a;
+        q.c[3] = x(0, k);
+        q.c[4] = x(1, k);
+        q.c[5] = x(2, k);
+      }
+    }
+  }
+
+ private:
+  double T_;
+  Eigen::Matrix3d inverse_;
+
+  // what the cubic, quartic and quintic terms must add at T
+  Eigen::Vector3d residual(const JmtState &start, const JmtState &end) const {
+    double T = T_;
+    return Eigen::Vector3d(end.p - (start.p + start.v*T + 0.5*start.a*T*T),
+                           end.v - (start.v + start.a*T),
+                           end.a - start.a);
+  }
+};
+
+// Solvers for a fixed set of horizons, built once at startup
+class JmtSolverBank {
+ public:
+  JmtSolverBank() {}
+
+  explicit JmtSolverBank(const vector<double> &horizons) {
+    for (size_t i = 0; i < horizons.size(); ++i) {
+      solvers_.push_back(JmtSolver(horizons[i]));
+    }
+  }
+
+  int size() const { return solvers_.size(); }
+  const JmtSolver &operator[](int i) const { return solvers_[i]; }
+
+ private:
+  vector<JmtSolver> solvers_;
+};
+
+#endif  // JMT_H
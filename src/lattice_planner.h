@@ -0,0 +1,237 @@
+#ifndef LATTICE_PLANNER_H
+#define LATTICE_PLANNER_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "collision.h"
+#include "jmt.h"
+#include "sensor_fusion.h"
+#include "thread_pool.h"
+
+// for convenience
+using std::vector;
+
+//
+// Sampling based planner over a lattice of Frenet trajectories.
+//
+// Each tick plan() builds one candidate per (target lane, target speed,
+// horizon). The candidate is a pair of jerk minimizing quintics: s(t) ends
+// at the target speed with no acceleration, and d(t) ends at rest on the
+// target lane center. Every candidate is then sampled to check its speed,
+// acceleration and jerk limits and its distance to the predicted traffic,
+// and to add up its cost. Collisions are checked with a CollisionChecker
+// that predicts the traffic once per tick. Candidates are spread over a
+// thread pool.
+//
+// The tick has a time budget. A candidate that has not been started when
+// the budget runs out is dropped. Candidates are ordered so the ones kept
+// first are those on the current lane, then the neighbouring ones.
+//
+
+struct LatticeConfig {
+  int lane_count = 3;
+  double lane_width = 4.0;
+  // lanes at most this far from the current one are planned to
+  int max_lane_change = 1;
+  // m/s, 49.5 mph
+  double speed_limit = 22.1;
+  // target speeds in m/s and horizons in s
+  vector<double> speeds = {4.0, 8.0, 12.0, 15.0, 18.0, 20.0, 21.0, 22.0};
+  vector<double> horizons = {2.0, 3.0, 4.0};
+  // the simulator flags 10 m/s^2 and 10 m/s^3
+  double max_accel = 9.0;
+  double max_jerk = 9.0;
+  // time step for the checks along a candidate, at most 256 steps per horizon
+  double dt = 0.1;
+  // vehicle footprint, and the closest allowed distances between footprints
+  // along and across the lane
+  double vehicle_length = 5.0;
+  double vehicle_width = 2.0;
+  double min_gap = 3.0;
+  double min_lateral_gap = 1.0;
+  // time gap kept to a slower vehicle ahead at the end of the horizon
+  double headway = 1.5;
+  // number of ranked candidates returned besides the best
+  int runner_ups = 2;
+  // time allowed for one plan() call
+  double budget_ms = 10.0;
+
+  // cost weights
+  double w_speed = 10.0;
+  double w_lane_change = 1.0;
+  double w_jerk = 1.0;
+  double w_gap = 20.0;
+};
+
+struct LatticeCandidate {
+  int lane;
+  double speed;
+  double horizon;
+  Quintic s;
+  Quintic d;
+  double cost;
+  bool feasible;
+};
+
+class LatticePlanner {
+ public:
+  LatticePlanner(const LatticeConfig &config, ThreadPool &pool)
+    : config_(config), pool_(pool), solvers_(config.horizons),
+      collision_(config.vehicle_length, config.vehicle_width,
+                 config.min_gap, config.min_lateral_gap) {}
+
+  const LatticeConfig &config() const { return config_; }
+
+  // Plans from the ego states along s and d, current_lane being the lane
+  // the ego is assigned to. Traffic is predicted at constant speed along
+  // its lane, starting t0 seconds before the ego states. Fills ranked with
+  // the feasible candidates of lowest cost, best first, and returns the
+  // number of candidates evaluated within the budget.
+  int plan(const JmtState &s0, const JmtState &d0, int current_lane,
+           const SensorFusionFrame &traffic, double t0,
+           vector<LatticeCandidate> &ranked) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+      std::chrono::microseconds((long)(config_.budget_ms * 1000.0));
+
+    generate(s0, d0, current_lane);
+    double longest = *std::max_element(config_.horizons.begin(), config_.horizons.end());
+    collision_.predict(traffic, t0, config_.dt, (int)(longest / config_.dt + 0.5) + 1);
+    int n = candidates_.size();
+    std::atomic<int> evaluated(0);
+    pool_.parallel_for(n, [&](int i) {
+      LatticeCandidate &c = candidates_[i];
+      if (std::chrono::steady_clock::now() >= deadline) {
+        c.feasible = false;
+        return;
+      }
+      evaluate(c, current_lane, traffic, t0);
+      ++evaluated;
+    });
+
+    ranked.clear();
+    for (int i = 0; i < n; ++i) {
+      if (candidates_[i].feasible) ranked.push_back(candidates_[i]);
+    }
+    int keep = std::min((int)ranked.size(), 1 + config_.runner_ups);
+    std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+                      [](const LatticeCandidate &a, const LatticeCandidate &b) {
+                        return a.cost < b.cost;
+                      });
+    ranked.resize(keep);
+    return evaluated;
+  }
+
+ private:
+  LatticeConfig config_;
+  ThreadPool &pool_;
+  JmtSolverBank solvers_;
+  CollisionChecker collision_;
+  // candidates of the current tick, kept to reuse their storage
+  vector<LatticeCandidate> candidates_;
+  vector<JmtState> start_;
+  vector<JmtState> end_;
+  vector<Quintic> out_;
+
+  void generate(const JmtState &s0, const JmtState &d0, int current_lane) {
+    candidates_.clear();
+    // current lane first, then the closer lanes
+    for (int offset = 0; offset <= config_.max_lane_change; ++offset) {
+      for (int side = (offset == 0) ? 1 : -1; side <= 1; side += 2) {
+        int lane = current_lane + side * offset;
+        if (lane < 0 || lane >= config_.lane_count) continue;
+        for (size_t v = 0; v < config_.speeds.size(); ++v) {
+          for (int h = 0; h < solvers_.size(); ++h) {
+            LatticeCandidate c;
+            c.lane = lane;
+            c.speed = config_.speeds[v];
+            c.horizon = solvers_[h].horizon();
+            c.cost = 0.0;
+            c.feasible = false;
+            candidates_.push_back(c);
+          }
+        }
+      }
+    }
+
+    // solve the quintics horizon by horizon, in batches
+    for (int h = 0; h < solvers_.size(); ++h) {
+      const JmtSolver &solver = solvers_[h];
+      double T = solver.horizon();
+      start_.clear();
+      end_.clear();
+      for (size_t i = 0; i < candidates_.size(); ++i) {
+        const LatticeCandidate &c = candidates_[i];
+        if (c.horizon != T) continue;
+        // s covers the distance of a linear change of speed
+        JmtState s1 = {s0.p + 0.5 * (s0.v + c.speed) * T, c.speed, 0.0};
+        JmtState d1 = {config_.lane_width * (c.lane + 0.5), 0.0, 0.0};
+        start_.push_back(s0);
+        end_.push_back(s1);
+        start_.push_back(d0);
+        end_.push_back(d1);
+      }
+      out_.resize(start_.size());
+      solver.solve(start_.data(), end_.data(), start_.size(), out_.data());
+      int k = 0;
+      for (size_t i = 0; i < candidates_.size(); ++i) {
+        LatticeCandidate &c = candidates_[i];
+        if (c.horizon != T) continue;
+        c.s = out_[k++];
+        c.d = out_[k++];
+      }
+    }
+  }
+
+  void evaluate(LatticeCandidate &c, int current_lane,
+                const SensorFusionFrame &traffic, double t0) const {
+    const LatticeConfig &cfg = config_;
+    double max_accel_sq = cfg.max_accel * cfg.max_accel;
+    double max_jerk_sq = cfg.max_jerk * cfg.max_jerk;
+    double jerk_sum = 0.0;
+    const int max_steps = 255;
+    double s[max_steps + 1], d[max_steps + 1], yaw[max_steps + 1];
+    int steps = std::min((int)(c.horizon / cfg.dt + 0.5), max_steps);
+    for (int k = 0; k <= steps; ++k) {
+      double t = k * cfg.dt;
+      double vs = c.s.velocity(t);
+      double vd = c.d.velocity(t);
+      double as = c.s.acceleration(t);
+      double ad = c.d.acceleration(t);
+      double js = c.s.jerk(t);
+      double jd = c.d.jerk(t);
+      if (vs < -0.1 || vs*vs + vd*vd > cfg.speed_limit * cfg.speed_limit) return;
+      if (as*as + ad*ad > max_accel_sq) return;
+      if (js*js + jd*jd > max_jerk_sq) return;
+      jerk_sum += js*js + jd*jd;
+      s[k] = c.s.position(t);
+      d[k] = c.d.position(t);
+      yaw[k] = atan2(vd, vs);
+    }
+    double closest;
+    if (collision_.collides(s, d, yaw, steps + 1, &closest)) return;
+
+    // at the end, keep the headway to a slower vehicle ahead on the lane
+    double s_end = c.s.position(c.horizon);
+    double d_end = c.d.position(c.horizon);
+    for (int i = 0; i < traffic.size(); ++i) {
+      if (fabs(traffic.d[i] - d_end) > 0.5 * cfg.lane_width) continue;
+      double gap = traffic.s[i] + (t0 + c.horizon) * traffic.speed[i] - s_end;
+      if (gap < 0) continue;
+      // with more room when still closing in on it
+      double closing = std::max(c.speed - traffic.speed[i], 0.0);
+      if (gap < cfg.vehicle_length + cfg.min_gap + (c.speed + closing) * cfg.headway) return;
+    }
+
+    c.cost = cfg.w_speed * (cfg.speed_limit - c.speed) / cfg.speed_limit
+           + cfg.w_lane_change * abs(c.lane - current_lane)
+           + cfg.w_jerk * jerk_sum / ((steps + 1) * max_jerk_sq)
+           + cfg.w_gap / closest;
+    c.feasible = true;
+  }
+};
+
+#endif  // LATTICE_PLANNER_H
@@ -0,0 +1,56 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+
+//
+// Single slot, latest wins mailbox between one producer and one consumer
+// thread.
+//
+// It is a triple buffer: the producer fills back() and publish() swaps it
+// with the middle slot, the consumer's take() swaps the middle slot with
+// front() when something new was published. Neither side ever waits for
+// the other, and a value published while the consumer is busy replaces the
+// previous one instead of queueing behind it, so the consumer always
+// works on the latest value. Slots are reused, so values with buffers
+// (strings, vectors) stop allocating once they have grown. Waking the
+// consumer is left to the caller.
+//
+
+template <typename T>
+class Mailbox {
+ public:
+  Mailbox() {}
+
+  Mailbox(const Mailbox &) = delete;
+  Mailbox &operator=(const Mailbox &) = delete;
+
+  // Producer side: the slot to fill before publish()
+  T &back() { return slots_[back_]; }
+
+  void publish() {
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Consumer side: true if a value was published since the last take(),
+  // which is then in front()
+  bool take() {
+    if (!(middle_.load(std::memory_order_acquire) & FRESH)) return false;
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  T &front() { return slots_[front_]; }
+
+ private:
+  static const int INDEX = 3;
+  static const int FRESH = 4;
+
+  T slots_[3];
+  // slot index owned by each side, and the one in between with the fresh flag
+  int back_ = 0;
+  int front_ = 1;
+  std::atomic<int> middle_{2};
+};
+
+#endif  // MAILBOX_H
@@ -0,0 +1,234 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "frenet_batch.h"
+#include "helpers.h"
+#include "waypoint_grid.h"
+
+// for convenience
+using std::vector;
+
+//
+// Highway map with the per-segment tables needed for Frenet conversions.
+//
+// The waypoints form a closed loop, segment i runs from waypoint i to
+// waypoint i+1 and the last one back to waypoint 0. Everything that only
+// depends on the map (segment lengths and headings, the arc length at each
+// waypoint, the spatial index) is computed once here, so a conversion costs
+// one lookup and one projection.
+//
+// The columns are read through pointers. They either point into storage the
+// map builds itself, or straight into a mapped compiled map, which the map
+// then keeps mapped. Copies of a map share the same columns.
+//
+
+class Map {
+ public:
+  Map() {}
+
+  Map(const vector<double> &x, const vector<double> &y, const vector<double> &s,
+      const vector<double> &dx, const vector<double> &dy, double max_s)
+    : max_s_(max_s) {
+    build(x, y, s, dx, dy);
+  }
+
+  // Per-waypoint columns, in the order they are stored in a compiled map
+  enum Column {
+    X, Y, S, DX, DY, SEG_LEN, HEADING, COS_HEADING, SIN_HEADING,
+    COLUMN_COUNT
+  };
+
+  // Uses precomputed columns of n waypoints in place, as mapped from a
+  // compiled map; storage keeps their memory alive. Only the spatial index
+  // is rebuilt.
+  void assign(int n, const double *const columns[COLUMN_COUNT], double max_s,
+              const std::shared_ptr<const void> &storage) {
+    storage_ = storage;
+    n_ = n;
+    max_s_ = max_s;
+    for (int c = 0; c < COLUMN_COUNT; ++c) {
+      columns_[c] = columns[c];
+    }
+    grid_.build(x(), y(), n_);
+  }
+
+  const double *column(Column c) const { return columns_[c]; }
+
+  int size() const { return n_; }
+  // The max s value before wrapping around the track back to 0
+  double max_s() const { return max_s_; }
+
+  const double *x() const { return columns_[X]; }
+  const double *y() const { return columns_[Y]; }
+  const double *s() const { return columns_[S]; }
+  const double *dx() const { return columns_[DX]; }
+  const double *dy() const { return columns_[DY]; }
+  const WaypointGrid &grid() const { return grid_; }
+
+  double segment_length(int i) const { return columns_[SEG_LEN][i]; }
+  double segment_heading(int i) const { return columns_[HEADING][i]; }
+
+  // Transform from Cartesian x,y coordinates to Frenet s,d coordinates
+  vector<double> getFrenet(double x, double y, double theta) const {
+    const double *maps_x = columns_[X];
+    const double *maps_y = columns_[Y];
+    const double *maps_s = columns_[S];
+    int next_wp = next_waypoint(x, y, theta);
+    int prev_wp = (next_wp == 0) ? size() - 1 : next_wp - 1;
+
+    double n_x = maps_x[next_wp] - maps_x[prev_wp];
+    double n_y = maps_y[next_wp] - maps_y[prev_wp];
+    double x_x = x - maps_x[prev_wp];
+    double x_y = y - maps_y[prev_wp];
+
+    // find the projection of x onto n
+    double proj_norm = (x_x*n_x + x_y*n_y) / (n_x*n_x + n_y*n_y);
+    double proj_x = proj_norm*n_x;
+    double proj_y = proj_norm*n_y;
+
+    double frenet_d = distance(x_x, x_y, proj_x, proj_y);
+
+    // see if d value is positive or negative by comparing it to a center point
+    double center_x = 1000 - maps_x[prev_wp];
+    double center_y = 2000 - maps_y[prev_wp];
+    double centerToPos = distance(center_x, center_y, x_x, x_y);
+    double centerToRef = distance(center_x, center_y, proj_x, proj_y);
+
+    if (centerToPos <= centerToRef) {
+      frenet_d *= -1;
+    }
+
+    // arc length up to the segment start comes from the table
+    double frenet_s = maps_s[prev_wp] + distance(0, 0, proj_x, proj_y);
+
+    return {frenet_s, frenet_d};
+  }
+
+  // Transform n Cartesian points with headings theta to Frenet, into
+  // caller-provided arrays
+  void getFrenet(const double *x, const double *y, const double *theta, int n,
+                 double *s, double *d) const {
+    // segments are looked up per point, the projections run in chunks
+    const int chunk = 64;
+    int prev[chunk];
+    int next[chunk];
+    for (int k0 = 0; k0 < n; k0 += chunk) {
+      int m = std::min(chunk, n - k0);
+      for (int k = 0; k < m; ++k) {
+        next[k] = next_waypoint(x[k0+k], y[k0+k], theta[k0+k]);
+        prev[k] = (next[k] == 0) ? size() - 1 : next[k] - 1;
+      }
+      frenet_batch::project(columns_[X], columns_[Y], columns_[S], prev, next,
+                            x + k0, y + k0, m, s + k0, d + k0);
+    }
+  }
+
+  // Index of the waypoint starting the segment that contains s, by binary
+  // search over the s column
+  int segment_at(double s) const {
+    const double *maps_s = columns_[S];
+    int prev_wp = std::lower_bound(maps_s, maps_s + n_, s) - maps_s - 1;
+    return std::max(prev_wp, 0);
+  }
+
+  // Same as segment_at(), but walks from the segment found by a previous
+  // query. For nearby or monotone s values this is O(1) per query.
+  int segment_at(double s, int &hint) const {
+    const double *maps_s = columns_[S];
+    int n = size();
+    int prev_wp = std::min(std::max(hint, 0), n - 1);
+    while (prev_wp < n - 1 && s > maps_s[prev_wp+1]) ++prev_wp;
+    while (prev_wp > 0 && s <= maps_s[prev_wp]) --prev_wp;
+    hint = prev_wp;
+    return prev_wp;
+  }
+
+  // Transform from Frenet s,d coordinates to Cartesian x,y
+  vector<double> getXY(double s, double d) const {
+    return segmentXY(segment_at(s), s, d);
+  }
+
+  // Transform from Frenet s,d coordinates to Cartesian x,y, for batches of
+  // queries; hint carries the segment between calls and may start at 0
+  vector<double> getXY(double s, double d, int &hint) const {
+    return segmentXY(segment_at(s, hint), s, d);
+  }
+
+ private:
+  // columns as loaded (waypoints) or computed (per-segment tables)
+  const double *columns_[COLUMN_COUNT] = {};
+  int n_ = 0;
+  double max_s_ = 0.0;
+  // owner of the columns: the vectors built by the map, or a mapped file
+  std::shared_ptr<const void> storage_;
+  WaypointGrid grid_;
+
+  // Returns next waypoint of the closest waypoint, as NextWaypoint() does
+  int next_waypoint(double x, double y, double theta) const {
+    int closest = grid_.closest_waypoint(x, y);
+    double heading = atan2(columns_[Y][closest] - y, columns_[X][closest] - x);
+    double angle = fabs(theta - heading);
+    angle = std::min(2*pi() - angle, angle);
+    if (angle > pi()/2) {
+      ++closest;
+      if (closest == n_) closest = 0;
+    }
+    return closest;
+  }
+
+  vector<double> segmentXY(int prev_wp, double s, double d) const {
+    double cos_heading = columns_[COS_HEADING][prev_wp];
+    double sin_heading = columns_[SIN_HEADING][prev_wp];
+    // the x,y,s along the segment
+    double seg_s = (s - columns_[S][prev_wp]);
+
+    double seg_x = columns_[X][prev_wp] + seg_s*cos_heading;
+    double seg_y = columns_[Y][prev_wp] + seg_s*sin_heading;
+
+    // the d axis points to the right of the heading
+    double x = seg_x + d*sin_heading;
+    double y = seg_y - d*cos_heading;
+
+    return {x, y};
+  }
+
+  void build(const vector<double> &x, const vector<double> &y, const vector<double> &s,
+             const vector<double> &dx, const vector<double> &dy) {
+    int n = x.size();
+    std::shared_ptr<vector<double> > storage =
+      std::make_shared<vector<double> >(COLUMN_COUNT * n);
+    double *column[COLUMN_COUNT];
+    for (int c = 0; c < COLUMN_COUNT; ++c) {
+      column[c] = storage->data() + c * n;
+      columns_[c] = column[c];
+    }
+    std::copy(x.begin(), x.end(), column[X]);
+    std::copy(y.begin(), y.end(), column[Y]);
+    std::copy(dx.begin(), dx.end(), column[DX]);
+    std::copy(dy.begin(), dy.end(), column[DY]);
+    for (int i = 0; i < n; ++i) {
+      int j = (i + 1) % n;
+      column[SEG_LEN][i] = distance(x[i], y[i], x[j], y[j]);
+      column[HEADING][i] = atan2(y[j] - y[i], x[j] - x[i]);
+      column[COS_HEADING][i] = cos(column[HEADING][i]);
+      column[SIN_HEADING][i] = sin(column[HEADING][i]);
+    }
+    // without an s column, s is the cumulative arc length along the waypoints
+    if ((int)s.size() == n) {
+      std::copy(s.begin(), s.end(), column[S]);
+    } else {
+      for (int i = 0; i < n; ++i) {
+        column[S][i] = (i == 0) ? 0.0 : column[S][i-1] + column[SEG_LEN][i-1];
+      }
+    }
+    n_ = n;
+    storage_ = storage;
+    grid_.build(column[X], column[Y], n);
+  }
+};
+
+#endif  // MAP_H
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "map.h"
+#include "map_file.h"
+#include "map_tiles.h"
+#include "reference_line.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Offline map compiler: reads the waypoint CSV, builds every table the
+// planner needs and writes them as a compiled map that the planner maps
+// into memory at startup.
+//
+// usage: map_compiler [-t tile_size] <map.csv> <map.bin> [max_s] [lane_count] [resolution]
+//
+//   -t          write a tile file for streaming instead, with tile_size
+//               waypoints per tile
+//   max_s       s value at which the track wraps around, defaults to the
+//               length of the closed waypoint loop
+//   lane_count  number of lanes, 1 to 8, defaults to 3
+//   resolution  reference line sample spacing in [m], defaults to 0.5
+//
+
+int main(int argc, char *argv[]) {
+  int tile_size = 0;
+  if (argc > 2 && string(argv[1]) == "-t") {
+    tile_size = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 3) {
+    std::cerr << "usage: map_compiler [-t tile_size]"
+              << " <map.csv> <map.bin> [max_s] [lane_count] [resolution]" << std::endl;
+    return -1;
+  }
+  string csv_file = argv[1];
+  string bin_file = argv[2];
+
+  vector<double> map_waypoints_x;
+  vector<double> map_waypoints_y;
+  vector<double> map_waypoints_s;
+  vector<double> map_waypoints_dx;
+  vector<double> map_waypoints_dy;
+  if (!load_map_csv(csv_file, map_waypoints_x, map_waypoints_y, map_waypoints_s,
+                    map_waypoints_dx, map_waypoints_dy) || map_waypoints_x.size() < 3) {
+    std::cerr << "Failed to read waypoints from " << csv_file << std::endl;
+    return -1;
+  }
+
+  int n = map_waypoints_x.size();
+  double max_s = loop_length(map_waypoints_x, map_waypoints_y, map_waypoints_s);
+  if (argc > 3) max_s = atof(argv[3]);
+  int lane_count = 3;
+  if (argc > 4) {
+    char *end;
+    long lanes = strtol(argv[4], &end, 10);
+    if (*argv[4] == '\0' || *end != '\0' || lanes < 1 || lanes > (long)MAX_LANE_COUNT) {
+      std::cerr << "lane_count must be between 1 and " << MAX_LANE_COUNT << std::endl;
+      return -1;
+    }
+    lane_count = lanes;
+  }
+  double resolution = (argc > 5) ? atof(argv[5]) : 0.5;
+
+  Map map(map_waypoints_x, map_waypoints_y, map_waypoints_s,
+          map_waypoints_dx, map_waypoints_dy, max_s);
+  ReferenceLine reference_line(map, resolution);
+
+  if (tile_size > 0) {
+    if (!write_map_tiles(bin_file, map, reference_line, tile_size)) {
+      std::cerr << "Failed to write " << bin_file << std::endl;
+      return -1;
+    }
+    std::cout << "Tiled " << n << " waypoints into "
+              << (n + tile_size - 1) / tile_size << " tiles in " << bin_file << std::endl;
+    return 0;
+  }
+
+  if (!write_compiled_map(bin_file, map, reference_line, lane_count)) {
+    std::cerr << "Failed to write " << bin_file << std::endl;
+    return -1;
+  }
+  std::cout << "Compiled " << n << " waypoints, max_s " << max_s
+            << ", " << reference_line.samples() << " reference samples into "
+            << bin_file << std::endl;
+  return 0;
+}
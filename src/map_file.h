@@ -0,0 +1,181 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "map.h"
+#include "reference_line.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Map file formats.
+//
+// The source format is the CSV shipped with the simulator, one waypoint per
+// line: x y s dx dy.
+//
+// The compiled format is a binary image of everything the planner builds
+// from the CSV, written offline by map_compiler and mapped into memory at
+// startup, so no text is parsed and no table is computed at boot. The map
+// and the reference line read their tables in place from the mapping:
+//
+//   MapFileHeader
+//   double[waypoint_count] for each Map::Column, in enum order
+//   double[4 * reference_samples]   reference line table (x, y, nx, ny)
+//
+// All values are in host byte order, the header size is a multiple of 8 so
+// every array stays 8 byte aligned.
+//
+
+const char MAP_FILE_MAGIC[8] = {'P', 'P', 'M', 'A', 'P', 0, 0, 0};
+const uint32_t MAP_FILE_VERSION = 1;
+// lanes a compiled map may declare, the lattice samples every one of them
+const uint32_t MAX_LANE_COUNT = 8;
+
+struct MapFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t lane_count;
+  uint64_t waypoint_count;
+  uint64_t reference_samples;
+  double max_s;
+  double reference_resolution;
+};
+
+// Reads the waypoint CSV into separate columns, returns false if the file
+// can not be opened
+bool load_map_csv(const string &file,
+                  vector<double> &x, vector<double> &y, vector<double> &s,
+                  vector<double> &dx, vector<double> &dy) {
+  std::ifstream in_map_(file.c_str(), std::ifstream::in);
+  if (!in_map_) return false;
+
+  string line;
+  while (getline(in_map_, line)) {
+    std::istringstream iss(line);
+    double wp_x;
+    double wp_y;
+    float wp_s;
+    float wp_dx;
+    float wp_dy;
+    iss >> wp_x;
+    iss >> wp_y;
+    iss >> wp_s;
+    iss >> wp_dx;
+    iss >> wp_dy;
+    x.push_back(wp_x);
+    y.push_back(wp_y);
+    s.push_back(wp_s);
+    dx.push_back(wp_dx);
+    dy.push_back(wp_dy);
+  }
+  return true;
+}
+
+// Length of the closed waypoint loop, the s of the last waypoint plus the
+// way back to the first one: the s value at which the track wraps around
+double loop_length(const vector<double> &x, const vector<double> &y, const vector<double> &s) {
+  size_t n = x.size();
+  return s[n-1] + distance(x[n-1], y[n-1], x[0], y[0]);
+}
+
+// Writes a compiled map, returns false on I/O errors. The map is written
+// next to the file and renamed over it, so a planner that has the old one
+// mapped keeps reading it intact.
+bool write_compiled_map(const string &file, const Map &map,
+                        const ReferenceLine &reference_line, int lane_count) {
+  MapFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+  header.version = MAP_FILE_VERSION;
+  header.lane_count = lane_count;
+  header.waypoint_count = map.size();
+  header.reference_samples = reference_line.samples();
+  header.max_s = map.max_s();
+  header.reference_resolution = reference_line.resolution();
+
+  string tmp_file = file + ".tmp";
+  std::ofstream out(tmp_file.c_str(), std::ofstream::binary | std::ofstream::trunc);
+  out.write((const char *)&header, sizeof(header));
+  for (int c = 0; c < Map::COLUMN_COUNT; ++c) {
+    out.write((const char *)map.column((Map::Column)c), map.size() * sizeof(double));
+  }
+  out.write((const char *)reference_line.table(),
+            4 * header.reference_samples * sizeof(double));
+  out.close();
+  if (!out.good()) {
+    unlink(tmp_file.c_str());
+    return false;
+  }
+  return rename(tmp_file.c_str(), file.c_str()) == 0;
+}
+
+// Unmaps a compiled map once neither the map nor the reference line reads
+// from it anymore
+struct MapUnmapper {
+  size_t size;
+  void operator()(const void *data) const { munmap((void *)data, size); }
+};
+
+// Maps a compiled map into memory and points the map and its reference
+// line into it. Returns false if the file is missing, truncated, corrupt
+// or was written by another version, leaving map and reference_line
+// untouched.
+bool load_compiled_map(const string &file, Map &map, ReferenceLine &reference_line,
+                       int *lane_count = nullptr) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MapFileHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+  std::shared_ptr<const void> storage(data, MapUnmapper{size});
+
+  const MapFileHeader *header = (const MapFileHeader *)data;
+  const double *arrays = (const double *)(header + 1);
+  uint64_t n = header->waypoint_count;
+  uint64_t samples = header->reference_samples;
+  double max_s = header->max_s;
+  double resolution = header->reference_resolution;
+  // counts are bounded by the file size before they are multiplied, and the
+  // table must cover s up to max_s, which the reference line indexes by
+  size_t doubles = (size - sizeof(MapFileHeader)) / sizeof(double);
+  bool valid = memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+               header->version == MAP_FILE_VERSION &&
+               n >= 3 && n <= doubles / Map::COLUMN_COUNT && n <= INT_MAX &&
+               samples >= 2 && samples <= doubles / 4 && samples <= INT_MAX &&
+               size == sizeof(MapFileHeader) +
+                       (Map::COLUMN_COUNT * n + 4 * samples) * sizeof(double) &&
+               max_s > 0.0 && resolution > 0.0 && max_s / resolution + 1.0 < samples &&
+               header->lane_count >= 1 && header->lane_count <= MAX_LANE_COUNT;
+  if (!valid) return false;
+
+  const double *columns[Map::COLUMN_COUNT];
+  for (int c = 0; c < Map::COLUMN_COUNT; ++c) {
+    columns[c] = arrays + c * n;
+  }
+  map.assign(n, columns, max_s, storage);
+  reference_line.assign(max_s, resolution, arrays + Map::COLUMN_COUNT * n, samples, storage);
+  if (lane_count) *lane_count = header->lane_count;
+  return true;
+}
+
+#endif  // MAP_FILE_H
@@ -0,0 +1,460 @@
+#ifndef MAP_TILES_H
+#define MAP_TILES_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "map.h"
+#include "reference_line.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Tiled map streaming for road networks too large to keep in memory.
+//
+// The map is cut along s into tiles of consecutive waypoints. Each tile file
+// entry holds the waypoints of its s range, plus the first waypoint of the
+// next tile so its last segment is complete, and the reference line samples
+// covering the same range. Only a bounded number of tiles is resident, in an
+// LRU cache. A background thread keeps the tiles around the ego positions
+// loaded, prefetching ahead along increasing s, so queries on the planning
+// path normally hit the cache. Every planner sharing the map moves its own
+// cursor, and the cache grows to hold the tiles around all of them.
+//
+// Tile file layout, all values in host byte order:
+//
+//   MapTilesHeader
+//   MapTileEntry[tile_count]
+//   per tile: double x[waypoints], y[waypoints], s[waypoints],
+//             double reference[4 * samples]   (x, y, nx, ny)
+//
+
+const char MAP_TILES_MAGIC[8] = {'P', 'P', 'T', 'I', 'L', 'E', 'S', 0};
+const uint32_t MAP_TILES_VERSION = 1;
+
+struct MapTilesHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t tile_count;
+  uint64_t waypoint_count;
+  double max_s;
+  double reference_resolution;
+};
+
+struct MapTileEntry {
+  double s_begin;          // s of the first waypoint of the tile
+  uint64_t offset;         // byte offset of the tile data in the file
+  uint64_t first_sample;   // global index of the first reference sample
+  uint32_t first_wp;       // global index of the first waypoint
+  uint32_t waypoints;      // waypoints stored, including the overlap
+  uint32_t samples;        // reference samples stored
+  uint32_t reserved;
+};
+
+// One resident tile
+struct MapTile {
+  int index;
+  MapTileEntry entry;
+  vector<double> x;
+  vector<double> y;
+  vector<double> s;
+  vector<double> reference;
+};
+
+// Cuts a map and its reference line into tiles of waypoints_per_tile
+// waypoints, returns false on I/O errors
+bool write_map_tiles(const string &file, const Map &map,
+                     const ReferenceLine &reference_line, int waypoints_per_tile) {
+  int n = map.size();
+  int tile_count = (n + waypoints_per_tile - 1) / waypoints_per_tile;
+  double resolution = reference_line.resolution();
+
+  MapTilesHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAP_TILES_MAGIC, sizeof(header.magic));
+  header.version = MAP_TILES_VERSION;
+  header.tile_count = tile_count;
+  header.waypoint_count = n;
+  header.max_s = map.max_s();
+  header.reference_resolution = resolution;
+
+  vector<MapTileEntry> entries(tile_count);
+  uint64_t offset = sizeof(header) + tile_count * sizeof(MapTileEntry);
+  for (int t = 0; t < tile_count; ++t) {
+    MapTileEntry &e = entries[t];
+    memset(&e, 0, sizeof(e));
+    int first = t * waypoints_per_tile;
+    int last = std::min(first + waypoints_per_tile, n);
+    double s_end = (last < n) ? map.s()[last] : map.max_s();
+    e.s_begin = map.s()[first];
+    e.offset = offset;
+    e.first_wp = first;
+    e.waypoints = last - first + 1;
+    e.first_sample = (uint64_t)(e.s_begin / resolution);
+    uint64_t last_sample = std::min((uint64_t)(s_end / resolution) + 1,
+                                    (uint64_t)reference_line.samples() - 1);
+    e.samples = last_sample - e.first_sample + 1;
+    offset += (3 * e.waypoints + 4 * e.samples) * sizeof(double);
+  }
+
+  std::ofstream out(file.c_str(), std::ofstream::binary | std::ofstream::trunc);
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)entries.data(), entries.size() * sizeof(MapTileEntry));
+  vector<double> column;
+  for (int t = 0; t < tile_count; ++t) {
+    const MapTileEntry &e = entries[t];
+    const double *src[3] = {map.x(), map.y(), map.s()};
+    for (int c = 0; c < 3; ++c) {
+      column.clear();
+      for (uint32_t k = 0; k < e.waypoints; ++k) {
+        int i = e.first_wp + k;
+        // the overlap of the last tile is waypoint 0, at the end of the loop
+        if (i == n) column.push_back(c == 2 ? map.max_s() : src[c][0]);
+        else column.push_back(src[c][i]);
+      }
+      out.write((const char *)column.data(), column.size() * sizeof(double));
+    }
+    out.write((const char *)(reference_line.table() + 4 * e.first_sample),
+              4 * e.samples * sizeof(double));
+  }
+  return out.good();
+}
+
+class TiledMap {
+ public:
+  TiledMap() {}
+
+  ~TiledMap() { close(); }
+
+  // Opens a tile file, keeping at most capacity tiles in memory and
+  // prefetching ahead tiles in front of the ego. Returns false if the file
+  // is missing, truncated, corrupt or was written by another version.
+  bool open(const string &file, int capacity = 16, int ahead = 4) {
+    close();
+    fd_ = ::open(file.c_str(), O_RDONLY);
+    if (fd_ < 0) return false;
+    struct stat st;
+    bool valid = fstat(fd_, &st) == 0 &&
+                 pread(fd_, &header_, sizeof(header_), 0) == (ssize_t)sizeof(header_) &&
+                 memcmp(header_.magic, MAP_TILES_MAGIC, sizeof(header_.magic)) == 0 &&
+                 header_.version == MAP_TILES_VERSION && header_.tile_count > 0 &&
+                 header_.tile_count <= (st.st_size - sizeof(header_)) / sizeof(MapTileEntry) &&
+                 header_.max_s > 0.0 && header_.reference_resolution > 0.0 &&
+                 header_.max_s / header_.reference_resolution < INT_MAX - 2;
+    if (valid) {
+      entries_.resize(header_.tile_count);
+      size_t bytes = entries_.size() * sizeof(MapTileEntry);
+      valid = pread(fd_, entries_.data(), bytes, sizeof(header_)) == (ssize_t)bytes;
+    }
+    for (size_t t = 0; valid && t < entries_.size(); ++t) {
+      valid = valid_entry(t, st.st_size);
+    }
+    if (!valid) {
+      close();
+      return false;
+    }
+    ahead_ = std::min(ahead, (int)header_.tile_count - 1);
+    // the tiles around one ego must fit, or prefetching would evict them
+    capacity_ = std::max(capacity, ahead_ + 2);
+    working_set_ = 0;
+    inv_resolution_ = 1.0 / header_.reference_resolution;
+    stop_ = false;
+    ++moves_;
+    prefetcher_ = std::thread(&TiledMap::prefetch_loop, this);
+    return true;
+  }
+
+  void close() {
+    if (prefetcher_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cond_.notify_one();
+      prefetcher_.join();
+    }
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    entries_.clear();
+    cache_.clear();
+    lru_.clear();
+    cursors_.clear();
+  }
+
+  bool is_open() const { return fd_ >= 0; }
+  double max_s() const { return header_.max_s; }
+  int tile_count() const { return entries_.size(); }
+  // tiles loaded on the query path because prefetching had not caught up
+  int misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+  }
+
+  // Starts tracking one more ego, returns the cursor to move it with
+  int open_cursor() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cursors_[next_cursor_] = -1;
+    return next_cursor_++;
+  }
+
+  // Stops tracking an ego, its tiles may then be evicted
+  void close_cursor(int cursor) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cursors_.erase(cursor) == 0) return;
+      ++moves_;
+    }
+    cond_.notify_one();
+  }
+
+  // Tells the prefetcher where the ego of a cursor is, tiles ahead of s get
+  // loaded in the background
+  void update_position(int cursor, double s) {
+    int tile = tile_at(wrap(s));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = cursors_.find(cursor);
+      if (it == cursors_.end() || it->second == tile) return;
+      it->second = tile;
+      ++moves_;
+    }
+    cond_.notify_one();
+  }
+
+  // Transform from Frenet s,d coordinates to Cartesian x,y. Returns false
+  // when the tile of s cannot be read, x and y are left unchanged.
+  bool getXY(double s, double d, double &x, double &y) const {
+    s = wrap(s);
+    std::shared_ptr<const MapTile> tile = get_tile(tile_at(s));
+    if (!tile) return false;
+    double pos = s * inv_resolution_;
+    int i = (int)pos;
+    double t = pos - i;
+    int local = std::min(std::max(i - (int)tile->entry.first_sample, 0),
+                         (int)tile->entry.samples - 2);
+    const double *a = &tile->reference[4*local];
+    const double *b = a + 4;
+    double nx = a[2] + t*(b[2] - a[2]);
+    double ny = a[3] + t*(b[3] - a[3]);
+    x = a[0] + t*(b[0] - a[0]) + d*nx;
+    y = a[1] + t*(b[1] - a[1]) + d*ny;
+    return true;
+  }
+
+  bool getXY(const double *s, const double *d, int n, double *x, double *y) const {
+    for (int k = 0; k < n; ++k) {
+      if (!getXY(s[k], d[k], x[k], y[k])) return false;
+    }
+    return true;
+  }
+
+  // Transform from Cartesian x,y coordinates to Frenet s,d coordinates, on
+  // the reference line samples getXY() interpolates, as ReferenceLine does.
+  // Walks the samples from s_hint to the interval the point projects onto,
+  // loading tiles on the way, so the hint should be close to the true s,
+  // e.g. the s of a previous point of the same path. Returns false when a
+  // tile on the way cannot be read.
+  bool getFrenet(double x, double y, double s_hint, double &s, double &d) const {
+    // interval of the sample at max_s, after which the loop starts over
+    int last = (int)(header_.max_s * inv_resolution_);
+    int i = std::min((int)(wrap(s_hint) * inv_resolution_), last);
+    std::shared_ptr<const MapTile> tile;
+    int step = 0;
+    double t = 0.0;
+    for (int k = 0; k <= last; ++k) {
+      if (!tile || !covers(*tile, i)) {
+        tile = get_tile(tile_at(i * header_.reference_resolution));
+        if (!tile || !covers(*tile, i)) return false;
+      }
+      const double *a = &tile->reference[4*(i - (int)tile->entry.first_sample)];
+      const double *b = a + 4;
+      double ex = b[0] - a[0];
+      double ey = b[1] - a[1];
+      t = ((x - a[0])*ex + (y - a[1])*ey) / (ex*ex + ey*ey);
+      // keep walking one way only, a point past the joint of two intervals
+      // would otherwise move back and forth between them
+      int next = (t < 0.0) ? -1 : (t > 1.0) ? 1 : 0;
+      if (next == 0 || next == -step) break;
+      step = next;
+      i = (i + step < 0) ? last : (i + step > last) ? 0 : i + step;
+    }
+    // after a full loop without a match, i has moved past the last tile read
+    if (!covers(*tile, i)) return false;
+    const double *a = &tile->reference[4*(i - (int)tile->entry.first_sample)];
+    const double *b = a + 4;
+    t = std::min(std::max(t, 0.0), 1.0);
+    double nx = a[2] + t*(b[2] - a[2]);
+    double ny = a[3] + t*(b[3] - a[3]);
+    d = (x - a[0] - t*(b[0] - a[0]))*nx + (y - a[1] - t*(b[1] - a[1]))*ny;
+    s = fmod((i + t) * header_.reference_resolution, header_.max_s);
+    return true;
+  }
+
+ private:
+  int fd_ = -1;
+  MapTilesHeader header_;
+  vector<MapTileEntry> entries_;
+  double inv_resolution_ = 2.0;
+  int capacity_ = 16;
+  int ahead_ = 4;
+
+  // LRU cache, most recently used tile at the front
+  mutable std::mutex mutex_;
+  mutable std::list<int> lru_;
+  mutable std::unordered_map<int, std::pair<std::shared_ptr<const MapTile>,
+                                            std::list<int>::iterator>> cache_;
+  mutable int misses_ = 0;
+
+  // prefetcher state, guarded by mutex_: the tile of every cursor, bumping
+  // moves_ when one changes, and the number of tiles around all of them
+  std::thread prefetcher_;
+  std::condition_variable cond_;
+  bool stop_ = false;
+  std::unordered_map<int, int> cursors_;
+  int next_cursor_ = 0;
+  unsigned moves_ = 0;
+  int working_set_ = 0;
+
+  double wrap(double s) const {
+    s = fmod(s, header_.max_s);
+    return (s < 0) ? s + header_.max_s : s;
+  }
+
+  // true when tile t lies within a file of size bytes, after the index, with
+  // its samples within the reference line and its s after the previous tile,
+  // as tile_at() searches by it. Counts are bounded before they are
+  // multiplied.
+  bool valid_entry(size_t t, uint64_t size) const {
+    const MapTileEntry &e = entries_[t];
+    uint64_t samples = (uint64_t)(header_.max_s / header_.reference_resolution) + 2;
+    uint64_t data = sizeof(header_) + entries_.size() * sizeof(MapTileEntry);
+    return e.waypoints >= 2 && e.samples >= 2 &&
+           e.first_sample <= samples && e.samples <= samples - e.first_sample &&
+           e.s_begin >= 0.0 && e.s_begin <= header_.max_s &&
+           (t == 0 || e.s_begin >= entries_[t - 1].s_begin) &&
+           e.offset >= data && e.offset <= size &&
+           (3 * (uint64_t)e.waypoints + 4 * (uint64_t)e.samples) <=
+             (size - e.offset) / sizeof(double);
+  }
+
+  // true when the tile holds both samples of interval i
+  static bool covers(const MapTile &tile, int i) {
+    return i >= (int)tile.entry.first_sample &&
+           i + 1 < (int)(tile.entry.first_sample + tile.entry.samples);
+  }
+
+  // tile whose s range contains s, by binary search over the tile index
+  int tile_at(double s) const {
+    int lo = 0;
+    int hi = entries_.size() - 1;
+    while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (entries_[mid].s_begin <= s) lo = mid;
+      else hi = mid - 1;
+    }
+    return lo;
+  }
+
+  // reads a tile from disk, nullptr if the file is shorter than its entry
+  // says or cannot be read
+  std::shared_ptr<const MapTile> load_tile(int index) const {
+    std::shared_ptr<MapTile> tile = std::make_shared<MapTile>();
+    tile->index = index;
+    tile->entry = entries_[index];
+    const MapTileEntry &e = tile->entry;
+    if (e.waypoints < 2 || e.samples < 2) return nullptr;
+    vector<double> *dst[4] = {&tile->x, &tile->y, &tile->s, &tile->reference};
+    size_t counts[4] = {e.waypoints, e.waypoints, e.waypoints, 4 * (size_t)e.samples};
+    off_t offset = e.offset;
+    for (int c = 0; c < 4; ++c) {
+      dst[c]->resize(counts[c]);
+      size_t bytes = counts[c] * sizeof(double);
+      if (pread(fd_, dst[c]->data(), bytes, offset) != (ssize_t)bytes) return nullptr;
+      offset += bytes;
+    }
+    return tile;
+  }
+
+  // Returns a resident tile, loading it on a miss. Callers keep the tile
+  // alive through the shared pointer even if it gets evicted meanwhile.
+  // A tile that fails to load is not cached, so it is read again on the next
+  // lookup, and nullptr is returned.
+  std::shared_ptr<const MapTile> get_tile(int index, bool prefetch = false) const {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = cache_.find(index);
+      if (it != cache_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second.second);
+        return it->second.first;
+      }
+      if (!prefetch) ++misses_;
+    }
+    // read from disk without holding the lock
+    std::shared_ptr<const MapTile> tile = load_tile(index);
+    if (!tile) return tile;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cache_.find(index);
+    if (it != cache_.end()) return it->second.first;
+    lru_.push_front(index);
+    cache_[index] = std::make_pair(tile, lru_.begin());
+    while ((int)lru_.size() > std::max(capacity_, working_set_)) {
+      cache_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    return tile;
+  }
+
+  void prefetch_loop() {
+    unsigned done = moves_ - 1;
+    vector<int> positions;
+    vector<int> wanted;
+    std::unordered_set<int> seen;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [&] { return stop_ || moves_ != done; });
+      if (stop_) return;
+      done = moves_;
+      positions.clear();
+      for (auto it = cursors_.begin(); it != cursors_.end(); ++it) {
+        if (it->second >= 0) positions.push_back(it->second);
+      }
+      // the current tile of every ego, the one behind, then ahead along the
+      // route; egos close to each other share tiles
+      int count = tile_count();
+      wanted.clear();
+      seen.clear();
+      for (int k = 0; k <= ahead_; k = (k == 0) ? -1 : (k < 0) ? 1 : k + 1) {
+        for (size_t i = 0; i < positions.size(); ++i) {
+          int tile = ((positions[i] + k) % count + count) % count;
+          if (seen.insert(tile).second) wanted.push_back(tile);
+        }
+      }
+      // the cache must hold all of them, or the egos would evict each
+      // other's tiles
+      working_set_ = wanted.size();
+      lock.unlock();
+      for (size_t i = 0; i < wanted.size(); ++i) get_tile(wanted[i], true);
+      lock.lock();
+    }
+  }
+};
+
+#endif  // MAP_TILES_H
@@ -0,0 +1,479 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "arc_length.h"
+#include "helpers.h"
+#include "json.hpp"
+#include "lattice_planner.h"
+#include "map_tiles.h"
+#include "reference_line.h"
+#include "spline.h"
+#include "telemetry.h"
+#include "thread_pool.h"
+
+// for convenience
+using nlohmann::json;
+using std::string;
+using std::vector;
+
+/*
+* returns the absolute velocity of a vehicle in [m/s]
+*/
+double get_vehicle_speed(const SensorFusionFrame &sensor_fusion, int i) {
+  return sensor_fusion.speed[i];
+}
+
+/*
+* returns the predicted distance in to a vehicle along the 's' axis, in [m]
+*/
+double get_vehicle_dist(const SensorFusionFrame &sensor_fusion, int i, double s, int prev_size) {
+  return ((sensor_fusion.s[i] + (double)prev_size * .02 * sensor_fusion.speed[i]) - s);
+}
+
+/*
+* closest vehicles of a lane around the ego, as indices into the sensor fusion frame, -1 if there is none
+*/
+struct LaneNeighbors {
+  int front;
+  int back;
+};
+
+/*
+* sorts every vehicle into its lane in a single pass, and keeps the closest one for each lane
+* that is within a distance buffer forward (front_buffer > 0) and backward (back_buffer < 0)
+*/
+void get_lane_neighbors(double s,
+                        const SensorFusionFrame &sensor_fusion,
+                        int prev_size,
+                        double front_buffer,
+                        double back_buffer,
+                        LaneNeighbors *neighbors,
+                        int lane_count) {
+  for (int lane = 0; lane < lane_count; lane++) {
+    neighbors[lane].front = -1;
+    neighbors[lane].back = -1;
+  }
+  for (int i = 0; i < sensor_fusion.size(); i++) {
+    float d = sensor_fusion.d[i];
+    // lanes are 4m wide, vehicles exactly on a lane marking belong to neither lane
+    int lane = (int)floor(d / 4);
+    if (lane < 0 || lane >= lane_count || d == 4*lane) continue;
+    double check_dist = get_vehicle_dist(sensor_fusion, i, s, prev_size);
+    LaneNeighbors &n = neighbors[lane];
+    // ahead of us within the buffer, the closest one has the lowest s
+    if (check_dist > 0 && check_dist < front_buffer) {
+      if (n.front < 0 || sensor_fusion.s[i] < sensor_fusion.s[n.front]) n.front = i;
+    }
+    // behind us within the buffer, the closest one has the highest s
+    else if (check_dist < 0 && check_dist > back_buffer) {
+      if (n.back < 0 || sensor_fusion.s[i] > sensor_fusion.s[n.back]) n.back = i;
+    }
+  }
+}
+
+/*
+* Decides reference velocity and best lane, based on sensor fusion information
+*/
+void behavior(double s,
+              double d,
+              const SensorFusionFrame &sensor_fusion,
+              double &ref_vel,
+              int &lane,
+              int prev_size,
+              double buffer = 30.0,
+              double w_dist = 40.0,
+              double w_speed = 1.0,
+              double w_stay = 5.0,
+              double w_coll = 1000.0) {
+  // select closest vehicles within range in all directions
+  LaneNeighbors neighbors[3];
+  get_lane_neighbors(s, sensor_fusion, prev_size, buffer, -buffer/3, neighbors, 3);
+  int left_front_car = neighbors[0].front;
+  int mid_front_car = neighbors[1].front;
+  int right_front_car = neighbors[2].front;
+  int left_back_car = neighbors[0].back;
+  int mid_back_car = neighbors[1].back;
+  int right_back_car = neighbors[2].back;
+  // cost for each lane
+  double left_cost = 0.0;
+  double mid_cost = 0.0;
+  double right_cost = 0.0;
+  // costs increase if a front car is too close or drive with low speed 
+  if (left_front_car >= 0) {
+    left_cost += w_speed * (49.5 - 2.24*get_vehicle_speed(sensor_fusion, left_front_car));
+    left_cost += w_dist / get_vehicle_dist(sensor_fusion, left_front_car, s, prev_size);
+  }
+  if (mid_front_car >= 0) {
+    mid_cost += w_speed * (49.5 - 2.24*get_vehicle_speed(sensor_fusion, mid_front_car));
+    mid_cost += w_dist / get_vehicle_dist(sensor_fusion, mid_front_car, s, prev_size);
+  }
+  if (right_front_car >= 0) {
+    right_cost += w_speed * (49.5 - 2.24*get_vehicle_speed(sensor_fusion, right_front_car));
+    right_cost += w_dist / get_vehicle_dist(sensor_fusion, right_front_car, s, prev_size);
+  }
+  // cost decrease of ego lane, to discourage unnecessary lane changes
+  if (lane == 0) left_cost -= w_stay;
+  if (lane == 1) mid_cost -= w_stay;
+  if (lane == 2) right_cost -= w_stay;
+  
+  // considerable cost increase if a back car in another lane is close, to prevent collision
+  if (left_back_car >= 0 && lane != 0) left_cost += w_coll;
+  if (mid_back_car >= 0 && lane != 1) mid_cost += w_coll;
+  if (right_back_car >= 0 && lane != 2) right_cost += w_coll;
+  
+  // debugging costs in console
+  // std::cout << left_cost << " " << mid_cost << " " << right_cost << std::endl;
+
+  // lane selection
+  // check if worth changing to right
+  if (lane == 0 && mid_cost < left_cost) lane++;
+  if (lane == 1 && right_cost < mid_cost && right_cost <= left_cost) lane++;
+  // check if worth changing to left
+  if (lane == 2 && mid_cost < right_cost) lane--;
+  if (lane == 1 && left_cost < mid_cost && left_cost < right_cost) lane--;
+  
+  // reference speed control
+  int target_vehicle = -1;
+  switch(lane) {
+    case 0: target_vehicle = left_front_car;
+    case 1: target_vehicle = mid_front_car;
+    case 2: target_vehicle = right_front_car;
+  }
+  // when following a car
+  if (target_vehicle >= 0) {
+    double target_speed = get_vehicle_speed(sensor_fusion, target_vehicle);
+    // set speed according to target
+    if (ref_vel/2.24 > target_speed) {
+      ref_vel -= .224;
+    } else if (ref_vel/2.24 < target_speed - 0.5) {
+      ref_vel += .224;
+    }
+  }
+  // when empty ahead, increase speed up to speed limit
+  else if (ref_vel < 49.5) {
+    ref_vel += .224;
+  }
+}
+
+/*
+* state carried from one planning cycle to the next
+*/
+struct PlannerState {
+  // start in lane 1
+  int lane = 1;
+  // start with zero reference to avoid jerk
+  double ref_vel = 0.0; // mph
+};
+
+/*
+* one planning cycle per telemetry message: lane and speed selection, then the path
+* sent back to the simulator. Everything it needs between cycles is kept here, so
+* the planner can run on any thread as long as it is one at a time.
+*/
+class Planner {
+ public:
+  Planner(const ReferenceLine &reference_line, TiledMap &tiled_map, ThreadPool &pool,
+          const LatticeConfig &lattice_config = LatticeConfig())
+    : reference_line_(reference_line), tiled_map_(tiled_map),
+      lattice_(lattice_config, pool),
+      path_collision_(lattice_config.vehicle_length, lattice_config.vehicle_width,
+                      lattice_config.min_gap, lattice_config.min_lateral_gap) {
+    // planners share the tiled map, each prefetches around its own ego
+    if (tiled_map_.is_open()) cursor_ = tiled_map_.open_cursor();
+  }
+
+  ~Planner() {
+    if (cursor_ >= 0) tiled_map_.close_cursor(cursor_);
+  }
+
+  Planner(const Planner &) = delete;
+  Planner &operator=(const Planner &) = delete;
+
+  const PlannerState &state() const { return state_; }
+
+  /*
+  * plans from a "42" websocket event, reply receives the message to send back,
+  * returns false when there is nothing to send
+  */
+  bool plan(const char *data, size_t length, string &reply) {
+    int &lane = state_.lane;
+    double &ref_vel = state_.ref_vel;
+
+    TelemetryStatus status = parse_telemetry(data, length, telemetry_);
+
+    if (status == TELEMETRY_OK) {
+      // Main car's localization Data
+      double car_x = telemetry_.x;
+      double car_y = telemetry_.y;
+      double car_s = telemetry_.s;
+      double car_d = telemetry_.d;
+      double car_yaw = telemetry_.yaw;
+
+      // Previous path data given to the Planner
+      const vector<double> &previous_path_x = telemetry_.previous_path_x;
+      // Previous path's end s and d values 
+      double end_path_s = telemetry_.end_path_s;
+      double end_path_d = telemetry_.end_path_d;
+
+      // Sensor Fusion Data, a list of all other cars on the same side of the road.
+      const SensorFusionFrame &sensor_fusion = telemetry_.sensor_fusion;
+      
+      // define a path made up of (x,y) points that the car will visit
+
+      // ego prediction along previous trajectory
+      int prev_size = previous_path_x.size();
+      if (prev_size > 0) {
+        car_s = end_path_s;
+      }
+
+      // select proper lane and speed, according to current state and other vehicles:
+      // the best trajectories of the lattice give the lanes and the speeds to approach,
+      // when none is feasible within the time budget the rule based behavior decides
+      JmtState s_start = {car_s, ref_vel/2.24, 0.0};
+      JmtState d_start = {prev_size > 0 ? end_path_d : car_d, 0.0, 0.0};
+      lattice_.plan(s_start, d_start, lane, sensor_fusion, prev_size*.02, ranked_);
+      options_.clear();
+      for (size_t k = 0; k < ranked_.size(); ++k) {
+        PlannerState option;
+        option.lane = ranked_[k].lane;
+        // same speed steps as behavior(), below the jerk limit
+        double target_vel = ranked_[k].speed*2.24;
+        if (ref_vel > target_vel) {
+          option.ref_vel = std::max(ref_vel - .224, target_vel);
+        } else {
+          option.ref_vel = std::min(ref_vel + .224, target_vel);
+        }
+        options_.push_back(option);
+      }
+      if (ranked_.empty()) {
+        options_.push_back(state_);
+        behavior(car_s, car_d, sensor_fusion, options_.back().ref_vel, options_.back().lane,
+                 prev_size);
+        // behind a stopped car behavior() keeps slowing down, but the spline needs
+        // distinct points
+        options_.back().ref_vel = std::max(options_.back().ref_vel, .224);
+      }
+      // last resort, sent even if its path fails the checks: keep the lane and slow
+      // down, but keep moving, as the spline needs distinct points
+      PlannerState keep_lane = state_;
+      keep_lane.ref_vel = std::max(ref_vel - .224, .224);
+      options_.push_back(keep_lane);
+
+      // the lattice only checked its quintics, so the path actually sent is checked
+      // again: from a few samples before the new points, to cover the joint with the
+      // previous path, up to its end
+      int first = std::max(prev_size - 3*CHECK_STRIDE, 0);
+      path_collision_.predict(sensor_fusion, (first + 1)*.02, CHECK_STRIDE*.02,
+                              (std::max(prev_size, 50) - first) / CHECK_STRIDE + 1);
+      for (size_t k = 0; k < options_.size(); ++k) {
+        // a tile that cannot be read leaves the simulator on the previous path
+        if (!build_path(options_[k], prev_size, car_x, car_y, car_yaw, car_s)) return false;
+        if (k + 1 == options_.size() || check_path(first, telemetry_.s)) {
+          state_ = options_[k];
+          break;
+        }
+      }
+
+      json msgJson;
+      msgJson["next_x"] = next_x_vals_;
+      msgJson["next_y"] = next_y_vals_;
+
+      reply = "42[\"control\","+ msgJson.dump()+"]";
+      return true;
+    } else if (status == TELEMETRY_MANUAL) {
+      // Manual driving
+      reply = "42[\"manual\",{}]";
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  // path points between two samples of the path checks, 0.2s: long enough that
+  // the speed steps between cycles do not show up as jerk
+  static const int CHECK_STRIDE = 10;
+
+  const ReferenceLine &reference_line_;
+  TiledMap &tiled_map_;
+  // prefetch cursor on the tiled map, -1 without tiles
+  int cursor_ = -1;
+  PlannerState state_;
+  // decoded telemetry, reused across cycles to keep its buffers allocated
+  Telemetry telemetry_;
+  // arc length table of the path spline, rebuilt in place every cycle
+  ArcLengthTable arc_length_;
+  // trajectory lattice for lane and speed selection, evaluated in parallel
+  LatticePlanner lattice_;
+  vector<LatticeCandidate> ranked_;
+  // lanes and speeds to build a path for, best first
+  vector<PlannerState> options_;
+  // the path of the option being tried, and its samples for the checks
+  vector<double> next_x_vals_;
+  vector<double> next_y_vals_;
+  vector<double> check_s_;
+  vector<double> check_d_;
+  vector<double> check_yaw_;
+  // traffic predicted at the samples of the path
+  CollisionChecker path_collision_;
+
+  /*
+  * builds the path sent to the simulator for a lane and a reference velocity: the
+  * previous path, then points along a spline through anchors 30m apart on the lane.
+  * Returns false when the anchors cannot be placed on the tiled map.
+  */
+  bool build_path(const PlannerState &option, int prev_size,
+                  double car_x, double car_y, double car_yaw, double car_s) {
+    const vector<double> &previous_path_x = telemetry_.previous_path_x;
+    const vector<double> &previous_path_y = telemetry_.previous_path_y;
+    int lane = option.lane;
+    double ref_vel = option.ref_vel;
+
+    // Create a list of widely spaced (x,y) waypoints, evenly spaced at 30m
+    vector<double> ptsx;
+    vector<double> ptsy;
+    
+    // reference x,y states
+    double ref_x = car_x;
+    double ref_y = car_y;
+
+    // if previous size is almost empty, use the car as starting reference
+    if(prev_size < 2){
+      // use 2 points that make the path tangent to the car
+      double prev_car_x = car_x - cos(car_yaw);
+      double prev_car_y = car_y - sin(car_yaw);
+      ptsx.push_back(prev_car_x);
+      ptsx.push_back(car_x);
+      ptsy.push_back(prev_car_y);
+      ptsy.push_back(car_y);
+    } else {
+      // use the previous path's end point as starting reference
+      // redefine reference state as previous path end point
+      ref_x = previous_path_x[prev_size-1];
+      ref_y = previous_path_y[prev_size-1];
+      double ref_x_prev = previous_path_x[prev_size-2];
+      double ref_y_prev = previous_path_y[prev_size-2];
+      ptsx.push_back(ref_x_prev);
+      ptsx.push_back(ref_x);
+      ptsy.push_back(ref_y_prev);
+      ptsy.push_back(ref_y);
+    }
+    
+    // in Frenet add evenly 30m spaced points ahead of the starting reference
+    double next_wp_s[3] = {car_s+30, car_s+60, car_s+90};
+    double next_wp_d[3] = {2.0+4*lane, 2.0+4*lane, 2.0+4*lane};
+    double next_wp_x[3];
+    double next_wp_y[3];
+    if (tiled_map_.is_open()) {
+      tiled_map_.update_position(cursor_, car_s);
+      if (!tiled_map_.getXY(next_wp_s, next_wp_d, 3, next_wp_x, next_wp_y)) return false;
+    } else {
+      reference_line_.getXY(next_wp_s, next_wp_d, 3, next_wp_x, next_wp_y);
+    }
+    
+    ptsx.insert(ptsx.end(), next_wp_x, next_wp_x+3);
+    ptsy.insert(ptsy.end(), next_wp_y, next_wp_y+3);
+    
+    // create a spline through the anchor points in map coordinates,
+    // there are always 5 of them
+    tk::fixed_spline2d<5> path;
+    assert(ptsx.size() == 5);
+    path.set_points(ptsx.data(),ptsy.data());
+
+    // define the actual (x,y) points we will use for the planner
+    vector<double> &next_x_vals = next_x_vals_;
+    vector<double> &next_y_vals = next_y_vals_;
+    next_x_vals.clear();
+    next_y_vals.clear();
+
+    // start with all the previous path points from last time
+    for (int i = 0; i < prev_size; i++) {
+      next_x_vals.push_back(previous_path_x[i]);
+      next_y_vals.push_back(previous_path_y[i]);
+    }
+    
+    // space the new points along the spline by the distance travelled
+    // at the reference velocity in each 20ms step, measured from the
+    // reference point up to the first anchor ahead
+    double t_ref = path.knot(1);
+    arc_length_.build(t_ref, path.knot(2), 30, path);
+    
+    // fill up the rest of our path planner, after the previous points, up to 50
+    int n_new = std::max(50 - prev_size, 0);
+    double step = .02*ref_vel/2.24;
+    double s_fill[50];
+    double t_fill[50];
+    double x_fill[50];
+    double y_fill[50];
+    for (int i = 1; i <= n_new; i++) {
+      s_fill[i-1] = i * step;
+    }
+    arc_length_.params_at(s_fill, n_new, t_fill);
+    path.eval(t_fill, x_fill, y_fill, n_new);
+    next_x_vals.insert(next_x_vals.end(), x_fill, x_fill+n_new);
+    next_y_vals.insert(next_y_vals.end(), y_fill, y_fill+n_new);
+    return true;
+  }
+
+  /*
+  * checks the path built last, sampled every CHECK_STRIDE points from index first: the
+  * speed, acceleration and jerk limits of the lattice, and the distance to the traffic
+  * predicted for the sample times. s_hint is the s of the ego, where the search of the
+  * Frenet coordinates of the samples starts. A path on tiles that cannot be read fails.
+  */
+  bool check_path(int first, double s_hint) {
+    const LatticeConfig &cfg = lattice_.config();
+    const vector<double> &x = next_x_vals_;
+    const vector<double> &y = next_y_vals_;
+    const double dt = CHECK_STRIDE*.02;
+    double max_s = tiled_map_.is_open() ? tiled_map_.max_s() : reference_line_.max_s();
+    int n = 0;
+    double v[3][2] = {}, a[2][2] = {};
+    check_s_.clear();
+    check_d_.clear();
+    for (size_t i = first; i < x.size(); i += CHECK_STRIDE, ++n) {
+      vector<double> frenet(2);
+      if (!tiled_map_.is_open()) {
+        frenet = reference_line_.getFrenet(x[i], y[i], s_hint);
+      } else if (!tiled_map_.getFrenet(x[i], y[i], s_hint, frenet[0], frenet[1])) {
+        return false;
+      }
+      // keep s continuous where the loop wraps around, as the predicted traffic is
+      double ds = n > 0 ? frenet[0] - s_hint : 0.0;
+      if (ds < -0.5*max_s) ds += max_s;
+      check_s_.push_back(n > 0 ? check_s_.back() + ds : frenet[0]);
+      check_d_.push_back(frenet[1]);
+      s_hint = frenet[0];
+      if (n == 0) continue;
+      // finite differences over the samples, the newest at index 0
+      v[2][0] = v[1][0]; v[2][1] = v[1][1];
+      v[1][0] = v[0][0]; v[1][1] = v[0][1];
+      v[0][0] = (x[i] - x[i - CHECK_STRIDE]) / dt;
+      v[0][1] = (y[i] - y[i - CHECK_STRIDE]) / dt;
+      if (v[0][0]*v[0][0] + v[0][1]*v[0][1] > cfg.speed_limit*cfg.speed_limit) return false;
+      if (n < 2) continue;
+      a[1][0] = a[0][0]; a[1][1] = a[0][1];
+      a[0][0] = (v[0][0] - v[1][0]) / dt;
+      a[0][1] = (v[0][1] - v[1][1]) / dt;
+      if (a[0][0]*a[0][0] + a[0][1]*a[0][1] > cfg.max_accel*cfg.max_accel) return false;
+      if (n < 3) continue;
+      double jx = (a[0][0] - a[1][0]) / dt;
+      double jy = (a[0][1] - a[1][1]) / dt;
+      if (jx*jx + jy*jy > cfg.max_jerk*cfg.max_jerk) return false;
+    }
+    // heading relative to the road from one sample to the next
+    check_yaw_.resize(n);
+    for (int k = 0; k < n; ++k) {
+      int j = std::min(k + 1, n - 1);
+      int i = j - 1;
+      check_yaw_[k] = (i < 0) ? 0.0 : atan2(check_d_[j] - check_d_[i], check_s_[j] - check_s_[i]);
+    }
+    return !path_collision_.collides(check_s_.data(), check_d_.data(), check_yaw_.data(), n);
+  }
+};
+
+#endif  // PLANNER_H
@@ -0,0 +1,195 @@
+#ifndef PLANNER_SERVER_H
+#define PLANNER_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mailbox.h"
+#include "map_tiles.h"
+#include "planner.h"
+#include "reference_line.h"
+#include "thread_pool.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Planner sessions for many simulator connections served by one process.
+//
+// Every connection gets its own PlannerSession: its own planner state and
+// a latest wins mailbox each way, so simulators never see each other's ego
+// state. Sessions are spread round robin over a fixed number of shards.
+// A shard is one planning thread with its own thread pool for the lattice.
+// It serves the sessions assigned to it one cycle at a time, always from
+// their newest telemetry. The maps are shared read-only by all sessions.
+//
+// The I/O side only touches the mailboxes: it fills inbox and calls
+// notify(), and it empties outbox when the reply callback fires. The
+// callback runs on the shard thread, so it should only wake the I/O loop.
+//
+
+struct PlannerSession {
+  PlannerSession(const ReferenceLine &reference_line, TiledMap &tiled_map,
+                 ThreadPool &pool, int shard, const LatticeConfig &lattice_config)
+    : planner(reference_line, tiled_map, pool, lattice_config), shard(shard) {}
+
+  Planner planner;
+  // websocket events in, replies out
+  Mailbox<string> inbox;
+  Mailbox<string> outbox;
+  // index of the shard serving the session
+  int shard;
+  // set by close(), the shard then drops the session
+  std::atomic<bool> closed{false};
+};
+
+class PlanningShard {
+ public:
+  PlanningShard(int pool_threads, const std::function<void()> &on_reply)
+    : pool_(pool_threads), on_reply_(on_reply) {
+    thread_ = std::thread(&PlanningShard::run, this);
+  }
+
+  ~PlanningShard() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+  }
+
+  PlanningShard(const PlanningShard &) = delete;
+  PlanningShard &operator=(const PlanningShard &) = delete;
+
+  ThreadPool &pool() { return pool_; }
+
+  void add(const std::shared_ptr<PlannerSession> &session) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      sessions_.push_back(session);
+      changed_ = true;
+      pending_ = true;
+    }
+    cond_.notify_one();
+  }
+
+  // called after filling a session's inbox, or closing it. pending_ is set
+  // under the lock, so the shard either sees it before it sleeps or gets
+  // the notification while waiting.
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_ = true;
+    }
+    cond_.notify_one();
+  }
+
+ private:
+  ThreadPool pool_;
+  std::function<void()> on_reply_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  // guarded by mutex_
+  bool stop_ = false;
+  bool pending_ = false;
+  // sessions of the shard, guarded by mutex_; the thread works on a copy,
+  // refreshed when changed_ is set
+  vector<std::shared_ptr<PlannerSession> > sessions_;
+  bool changed_ = false;
+
+  void run() {
+    vector<std::shared_ptr<PlannerSession> > local;
+    while (true) {
+      {
+        // sleep until the next event, every pass serves all the sessions
+        // whose inbox was filled before pending_ got cleared
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return pending_ || stop_; });
+        if (stop_) return;
+        pending_ = false;
+        if (changed_) {
+          local = sessions_;
+          changed_ = false;
+        }
+      }
+      bool any_closed = false;
+      for (size_t i = 0; i < local.size(); ++i) {
+        PlannerSession &session = *local[i];
+        if (session.closed) {
+          any_closed = true;
+          continue;
+        }
+        if (!session.inbox.take()) continue;
+        const string &event = session.inbox.front();
+        if (session.planner.plan(event.data(), event.length(), session.outbox.back())) {
+          session.outbox.publish();
+          on_reply_();
+        }
+      }
+      if (any_closed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        vector<std::shared_ptr<PlannerSession> > open;
+        for (size_t i = 0; i < sessions_.size(); ++i) {
+          if (!sessions_[i]->closed) open.push_back(sessions_[i]);
+        }
+        sessions_.swap(open);
+        local = sessions_;
+        changed_ = false;
+      }
+    }
+  }
+};
+
+class PlannerServer {
+ public:
+  // shards planning threads, each with pool_threads lattice workers besides
+  // itself; on_reply runs on a shard thread whenever a reply is ready
+  PlannerServer(const ReferenceLine &reference_line, TiledMap &tiled_map,
+                int shards, int pool_threads, const std::function<void()> &on_reply,
+                const LatticeConfig &lattice_config = LatticeConfig())
+    : reference_line_(reference_line), tiled_map_(tiled_map),
+      lattice_config_(lattice_config) {
+    for (int i = 0; i < std::max(shards, 1); ++i) {
+      shards_.push_back(std::unique_ptr<PlanningShard>(new PlanningShard(pool_threads, on_reply)));
+    }
+  }
+
+  int shards() const { return shards_.size(); }
+
+  // Starts a session for a new connection
+  std::shared_ptr<PlannerSession> open() {
+    int shard = next_shard_++ % shards_.size();
+    std::shared_ptr<PlannerSession> session = std::make_shared<PlannerSession>(
+      reference_line_, tiled_map_, shards_[shard]->pool(), shard, lattice_config_);
+    shards_[shard]->add(session);
+    return session;
+  }
+
+  // New telemetry is in the session's inbox
+  void notify(const PlannerSession &session) {
+    shards_[session.shard]->wake();
+  }
+
+  // Ends a session, its shard drops it on its next pass
+  void close(const std::shared_ptr<PlannerSession> &session) {
+    session->closed = true;
+    shards_[session->shard]->wake();
+  }
+
+ private:
+  const ReferenceLine &reference_line_;
+  TiledMap &tiled_map_;
+  LatticeConfig lattice_config_;
+  vector<std::unique_ptr<PlanningShard> > shards_;
+  unsigned next_shard_ = 0;
+};
+
+#endif  // PLANNER_SERVER_H
@@ -0,0 +1,173 @@
+#ifndef REFERENCE_LINE_H
+#define REFERENCE_LINE_H
+
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "frenet_batch.h"
+#include "map.h"
+#include "spline.h"
+
+// for convenience
+using std::vector;
+
+//
+// Smooth reference line of the highway, sampled into a dense lookup table.
+//
+// At construction x(s), y(s), dx(s) and dy(s) are fitted as cubic splines
+// through the map waypoints, then sampled every `resolution` meters of s.
+// Each sample stores x, y, nx, ny next to each other, so a Frenet to
+// Cartesian conversion reads two neighbouring samples and interpolates
+// between them. The table takes 32 bytes per sample, which is
+// 32 * max_s / resolution bytes in total: coarser resolutions trade accuracy
+// for memory on long maps. A table restored from a compiled map is read in
+// place from the mapping.
+//
+
+class ReferenceLine {
+ public:
+  ReferenceLine() {}
+
+  explicit ReferenceLine(const Map &map, double resolution = 0.5) {
+    build(map, resolution);
+  }
+
+  void build(const Map &map, double resolution = 0.5) {
+    max_s_ = map.max_s();
+    resolution_ = resolution;
+    inv_resolution_ = 1.0 / resolution;
+
+    // continue the waypoints over the start and end of the loop, so the
+    // splines are smooth where s wraps around
+    const int overlap = 3;
+    int n = map.size();
+    vector<double> s, x, y, dx, dy;
+    for (int k = -overlap; k < n + overlap; ++k) {
+      int i = ((k % n) + n) % n;
+      double offset = (k < 0) ? -max_s_ : (k >= n) ? max_s_ : 0.0;
+      s.push_back(map.s()[i] + offset);
+      x.push_back(map.x()[i]);
+      y.push_back(map.y()[i]);
+      dx.push_back(map.dx()[i]);
+      dy.push_back(map.dy()[i]);
+    }
+    tk::spline spline_x, spline_y, spline_dx, spline_dy;
+    spline_x.set_points(s, x);
+    spline_y.set_points(s, y);
+    spline_dx.set_points(s, dx);
+    spline_dy.set_points(s, dy);
+
+    // one sample past max_s, so the last interval has both ends
+    samples_ = (int)(max_s_ * inv_resolution_) + 2;
+    std::shared_ptr<vector<double> > storage = std::make_shared<vector<double> >(4 * samples_);
+    double *table = storage->data();
+    for (int i = 0; i < samples_; ++i) {
+      double si = i * resolution_;
+      double nx = spline_dx(si);
+      double ny = spline_dy(si);
+      double norm = sqrt(nx*nx + ny*ny);
+      table[4*i] = spline_x(si);
+      table[4*i + 1] = spline_y(si);
+      table[4*i + 2] = nx / norm;
+      table[4*i + 3] = ny / norm;
+    }
+    table_ = table;
+    storage_ = storage;
+  }
+
+  // Uses a table sampled earlier in place, as mapped from a compiled map;
+  // storage keeps its memory alive
+  void assign(double max_s, double resolution, const double *table, int samples,
+              const std::shared_ptr<const void> &storage) {
+    max_s_ = max_s;
+    resolution_ = resolution;
+    inv_resolution_ = 1.0 / resolution;
+    samples_ = samples;
+    table_ = table;
+    storage_ = storage;
+  }
+
+  double max_s() const { return max_s_; }
+  double resolution() const { return resolution_; }
+  size_t memory_bytes() const { return 4 * samples_ * sizeof(double); }
+  int samples() const { return samples_; }
+  // x, y, nx, ny per sample
+  const double *table() const { return table_; }
+
+  // Transform from Frenet s,d coordinates to Cartesian x,y
+  void getXY(double s, double d, double &x, double &y) const {
+    // wrap s around the loop
+    s = fmod(s, max_s_);
+    if (s < 0) s += max_s_;
+    double pos = s * inv_resolution_;
+    int i = (int)pos;
+    double t = pos - i;
+    const double *a = &table_[4*i];
+    const double *b = a + 4;
+    double px = a[0] + t*(b[0] - a[0]);
+    double py = a[1] + t*(b[1] - a[1]);
+    double nx = a[2] + t*(b[2] - a[2]);
+    double ny = a[3] + t*(b[3] - a[3]);
+    x = px + d*nx;
+    y = py + d*ny;
+  }
+
+  vector<double> getXY(double s, double d) const {
+    double x, y;
+    getXY(s, d, x, y);
+    return {x, y};
+  }
+
+  // Transform n Frenet points to Cartesian, into caller-provided arrays
+  void getXY(const double *s, const double *d, int n, double *x, double *y) const {
+    frenet_batch::reference_xy(table_, max_s_, inv_resolution_, s, d, n, x, y);
+  }
+
+  // Transform from Cartesian x,y coordinates to Frenet s,d coordinates.
+  // Walks the samples from s_hint to the interval the point projects onto,
+  // so the hint should be close to the true s, e.g. the s of a previous
+  // point of the same path.
+  vector<double> getFrenet(double x, double y, double s_hint) const {
+    // interval of the sample at max_s, after which the loop starts over
+    int last = (int)(max_s_ * inv_resolution_);
+    s_hint = fmod(s_hint, max_s_);
+    if (s_hint < 0) s_hint += max_s_;
+    int i = std::min((int)(s_hint * inv_resolution_), last);
+    int step = 0;
+    double t = 0.0;
+    for (int k = 0; k <= last; ++k) {
+      const double *a = &table_[4*i];
+      const double *b = a + 4;
+      double ex = b[0] - a[0];
+      double ey = b[1] - a[1];
+      t = ((x - a[0])*ex + (y - a[1])*ey) / (ex*ex + ey*ey);
+      // keep walking one way only, a point past the joint of two intervals
+      // would otherwise move back and forth between them
+      int next = (t < 0.0) ? -1 : (t > 1.0) ? 1 : 0;
+      if (next == 0 || next == -step) break;
+      step = next;
+      i = (i + step < 0) ? last : (i + step > last) ? 0 : i + step;
+    }
+    t = std::min(std::max(t, 0.0), 1.0);
+    const double *a = &table_[4*i];
+    const double *b = a + 4;
+    double nx = a[2] + t*(b[2] - a[2]);
+    double ny = a[3] + t*(b[3] - a[3]);
+    double d = (x - a[0] - t*(b[0] - a[0]))*nx + (y - a[1] - t*(b[1] - a[1]))*ny;
+    double s = fmod((i + t) * resolution_, max_s_);
+    return {s, d};
+  }
+
+ private:
+  double max_s_ = 0.0;
+  double resolution_ = 0.5;
+  double inv_resolution_ = 2.0;
+  int samples_ = 0;
+  // x, y, nx, ny per sample
+  const double *table_ = nullptr;
+  // owner of the table: the vector built here, or a mapped file
+  std::shared_ptr<const void> storage_;
+};
+
+#endif  // REFERENCE_LINE_H
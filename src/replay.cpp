@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "capture_log.h"
+#include "map.h"
+#include "map_file.h"
+#include "map_tiles.h"
+#include "planner.h"
+#include "reference_line.h"
+#include "thread_pool.h"
+
+// for convenience
+using std::string;
+using std::vector;
+
+//
+// Offline replay of a capture written by path_planning -c: feeds every
+// captured telemetry frame, in capture order, straight from the mapped log
+// into a planner per session, and compares each reply with the control
+// message that was sent live for that frame.
+//
+// Replays are deterministic: the planners run single threaded with no time
+// budget, so the lattice always evaluates every candidate. The live server
+// does have a budget and drops frames that arrive while it is busy, so a
+// difference from the capture is reported, not treated as a failure; two
+// replays of the same capture always agree.
+//
+// usage: replay [-o out.log] <capture.log> <map>
+//
+//   -o    write the replayed telemetry and replies as a new capture, to
+//         compare two builds
+//   map   compiled map from map_compiler, or the waypoint csv
+//
+
+/*
+* loads a compiled map, with its lane count, or builds the tables from the
+* waypoint csv
+*/
+bool load_map(const string &file, Map &map, ReferenceLine &reference_line, int *lane_count) {
+  if (load_compiled_map(file, map, reference_line, lane_count)) return true;
+  vector<double> map_waypoints_x;
+  vector<double> map_waypoints_y;
+  vector<double> map_waypoints_s;
+  vector<double> map_waypoints_dx;
+  vector<double> map_waypoints_dy;
+  if (!load_map_csv(file, map_waypoints_x, map_waypoints_y, map_waypoints_s,
+                    map_waypoints_dx, map_waypoints_dy) || map_waypoints_x.size() < 3) {
+    return false;
+  }
+  // The max s value before wrapping around the track back to 0
+  double max_s = loop_length(map_waypoints_x, map_waypoints_y, map_waypoints_s);
+  map = Map(map_waypoints_x, map_waypoints_y, map_waypoints_s,
+            map_waypoints_dx, map_waypoints_dy, max_s);
+  // sampled every 0.5m
+  reference_line.build(map, 0.5);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  string out_file;
+  if (argc > 2 && string(argv[1]) == "-o") {
+    out_file = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 3) {
+    std::cerr << "usage: replay [-o out.log] <capture.log> <map>" << std::endl;
+    return -1;
+  }
+  string capture_file = argv[1];
+  string map_file = argv[2];
+
+  CaptureReader capture;
+  if (!capture.open(capture_file)) {
+    std::cerr << "Failed to open capture " << capture_file << std::endl;
+    return -1;
+  }
+  // no tiles and no workers; an unbounded budget so no candidate is cut
+  TiledMap tiled_map;
+  ThreadPool pool(0);
+  LatticeConfig config;
+  config.budget_ms = 1e9;
+
+  Map map;
+  ReferenceLine reference_line;
+  if (!load_map(map_file, map, reference_line, &config.lane_count)) {
+    std::cerr << "Failed to load map " << map_file << std::endl;
+    return -1;
+  }
+  CaptureWriter out;
+  if (!out_file.empty() && !out.open(out_file)) {
+    std::cerr << "Failed to create " << out_file << std::endl;
+    return -1;
+  }
+
+  std::map<uint32_t, std::unique_ptr<Planner> > planners;
+  // per session, the reply to the last replayed frame, until the captured
+  // control message that answered it
+  std::map<uint32_t, string> pending;
+  string reply;
+  vector<double> cycle_us;
+  int matched = 0;
+  int differed = 0;
+
+  for (int i = 0; i < capture.size(); ++i) {
+    CaptureRecord record = capture.record(i);
+    if (record.type == CAPTURE_CONTROL) {
+      std::map<uint32_t, string>::iterator it = pending.find(record.session);
+      if (it == pending.end()) continue;
+      if (it->second == string(record.data, record.length)) {
+        ++matched;
+      } else {
+        ++differed;
+      }
+      pending.erase(it);
+      continue;
+    }
+
+    std::unique_ptr<Planner> &planner = planners[record.session];
+    if (!planner) planner.reset(new Planner(reference_line, tiled_map, pool, config));
+    // a frame the live server skipped has no control message to compare to
+    pending.erase(record.session);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool replied = planner->plan(record.data, record.length, reply);
+    cycle_us.push_back(std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start).count());
+
+    if (out.is_open()) out.append(CAPTURE_TELEMETRY, record.session, record.data, record.length);
+    if (replied) {
+      pending[record.session] = reply;
+      if (out.is_open()) out.append(CAPTURE_CONTROL, record.session, reply.data(), reply.length());
+    }
+  }
+
+  std::cout << "Replayed " << cycle_us.size() << " frames of " << planners.size()
+            << " sessions from " << capture_file << std::endl;
+  std::cout << "Replies matching the capture: " << matched << ", differing: " << differed
+            << std::endl;
+  if (!cycle_us.empty()) {
+    vector<double> sorted = cycle_us;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (size_t i = 0; i < sorted.size(); ++i) total += sorted[i];
+    std::cout << "Cycle time [us]: mean " << total / sorted.size()
+              << ", median " << sorted[sorted.size() / 2]
+              << ", p99 " << sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)]
+              << ", max " << sorted.back() << std::endl;
+  }
+  return 0;
+}
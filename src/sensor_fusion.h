@@ -0,0 +1,56 @@
+#ifndef SENSOR_FUSION_H
+#define SENSOR_FUSION_H
+
+#include <math.h>
+#include <vector>
+
+// for convenience
+using std::vector;
+
+//
+// Sensor fusion data of one tick, stored column-wise.
+//
+// Each column is a contiguous array indexed by the vehicle's position in the
+// frame, so per-lane scans read only the columns they need. The frame is
+// meant to be reused: clear() keeps the capacity of every column, so once
+// the traffic density is reached no allocation happens per tick.
+//
+
+struct SensorFusionFrame {
+  vector<int> id;         // unique id of the vehicle
+  vector<double> x;       // map x position in [m]
+  vector<double> y;       // map y position in [m]
+  vector<double> vx;      // x velocity in [m/s]
+  vector<double> vy;      // y velocity in [m/s]
+  vector<double> s;       // Frenet s position in [m]
+  vector<double> d;       // Frenet d position in [m]
+  vector<double> speed;   // absolute velocity in [m/s], derived from vx, vy
+
+  int size() const { return id.size(); }
+  bool empty() const { return id.empty(); }
+
+  void clear() {
+    id.clear();
+    x.clear();
+    y.clear();
+    vx.clear();
+    vy.clear();
+    s.clear();
+    d.clear();
+    speed.clear();
+  }
+
+  void push_back(int id_, double x_, double y_, double vx_, double vy_,
+                 double s_, double d_) {
+    id.push_back(id_);
+    x.push_back(x_);
+    y.push_back(y_);
+    vx.push_back(vx_);
+    vy.push_back(vy_);
+    s.push_back(s_);
+    d.push_back(d_);
+    speed.push_back(sqrt(vx_*vx_ + vy_*vy_));
+  }
+};
+
+#endif  // SENSOR_FUSION_H
@@ -28,7 +28,9 @@
 #define TK_SPLINE_H
 
 #include <cstdio>
+#include <cmath>
 #include <cassert>
+#include <array>
 #include <vector>
 #include <algorithm>
 
@@ -41,41 +43,6 @@ namespace
 namespace tk
 {
 
-// band matrix solver
-class band_matrix
-{
-private:
-    std::vector< std::vector<double> > m_upper;  // upper band
-    std::vector< std::vector<double> > m_lower;  // lower band
-public:
-    band_matrix() {};                             // constructor
-    band_matrix(int dim, int n_u, int n_l);       // constructor
-    ~band_matrix() {};                            // destructor
-    void resize(int dim, int n_u, int n_l);      // init with dim,n_u,n_l
-    int dim() const;                             // matrix dimension
-    int num_upper() const
-    {
-        return m_upper.size()-1;
-    }
-    int num_lower() const
-    {
-        return m_lower.size()-1;
-    }
-    // access operator
-    double & operator () (int i, int j);            // write
-    double   operator () (int i, int j) const;      // read
-    // we can store an additional diogonal (in m_lower)
-    double& saved_diag(int i);
-    double  saved_diag(int i) const;
-    void lu_decompose();
-    std::vector<double> r_solve(const std::vector<double>& b) const;
-    std::vector<double> l_solve(const std::vector<double>& b) const;
-    std::vector<double> lu_solve(const std::vector<double>& b,
-                                 bool is_lu_decomposed=false);
-
-};
-
-
 // spline interpolation
 class spline
 {
@@ -111,164 +78,137 @@ public:
     void set_points(const std::vector<double>& x,
                     const std::vector<double>& y, bool cubic_spline=true);
     double operator() (double x) const;
+    // derivative of the given order (1, 2 or 3) at x
+    double deriv(int order, double x) const;
+    // curvature of the graph y=f(x) at x, f''/(1+f'^2)^(3/2)
+    double curvature(double x) const;
+    // evaluates the spline at n points, fastest when xs[] is sorted
+    void eval(const double* xs, double* out, size_t n) const;
+    // same for the derivative of the given order and for the curvature
+    void deriv(int order, const double* xs, double* out, size_t n) const;
+    void curvature(const double* xs, double* out, size_t n) const;
 };
 
 
+// row i of the tridiagonal system for the spline parameters b[] of the n
+// points x[], y[] and the given boundary conditions
+template<typename Points>
+void cubic_spline_row(const Points& x, const Points& y, int n, int i,
+                      spline::bd_type left, double left_value,
+                      spline::bd_type right, double right_value,
+                      double& lower, double& diag, double& upper, double& rhs);
 
-// ---------------------------------------------------------------------
-// implementation part, which could be separated into a cpp file
-// ---------------------------------------------------------------------
 
+// derivative of the given order (0 for the value) of the polynomial
+// ((a*h + b)*h + c)*h + y at h
+double cubic_poly_deriv(int order, double a, double b, double c, double y,
+                        double h);
 
-// band_matrix implementation
-// -------------------------
 
-band_matrix::band_matrix(int dim, int n_u, int n_l)
-{
-    resize(dim, n_u, n_l);
-}
-void band_matrix::resize(int dim, int n_u, int n_l)
-{
-    assert(dim>0);
-    assert(n_u>=0);
-    assert(n_l>=0);
-    m_upper.resize(n_u+1);
-    m_lower.resize(n_l+1);
-    for(size_t i=0; i<m_upper.size(); i++) {
-        m_upper[i].resize(dim);
-    }
-    for(size_t i=0; i<m_lower.size(); i++) {
-        m_lower[i].resize(dim);
-    }
-}
-int band_matrix::dim() const
-{
-    if(m_upper.size()>0) {
-        return m_upper[0].size();
-    } else {
-        return 0;
-    }
-}
+// batch evaluation of a spline given by its n points and coefficients, the
+// segment of each query is found with a cursor that moves from the segment
+// of the previous query, so sorted queries cost O(1) each; order selects
+// the value (0) or a derivative (1, 2 or 3)
+void cubic_spline_eval(const double* x, const double* y, const double* a,
+                       const double* b, const double* c, double b0, double c0,
+                       int n, const double* xs, double* out, size_t count,
+                       int order=0);
 
+// batch curvature f''/(1+f'^2)^(3/2) of the same spline
+void cubic_spline_curvature(const double* x, const double* y, const double* a,
+                            const double* b, const double* c, double b0, double c0,
+                            int n, const double* xs, double* out, size_t count);
 
-// defines the new operator (), so that we can access the elements
-// by A(i,j), index going from i=0,...,dim()-1
-double & band_matrix::operator () (int i, int j)
-{
-    int k=j-i;       // what band is the entry
-    assert( (i>=0) && (i<dim()) && (j>=0) && (j<dim()) );
-    assert( (-num_lower()<=k) && (k<=num_upper()) );
-    // k=0 -> diogonal, k<0 lower left part, k>0 upper right part
-    if(k>=0)   return m_upper[k][i];
-    else	    return m_lower[-k][i];
-}
-double band_matrix::operator () (int i, int j) const
-{
-    int k=j-i;       // what band is the entry
-    assert( (i>=0) && (i<dim()) && (j>=0) && (j<dim()) );
-    assert( (-num_lower()<=k) && (k<=num_upper()) );
-    // k=0 -> diogonal, k<0 lower left part, k>0 upper right part
-    if(k>=0)   return m_upper[k][i];
-    else	    return m_lower[-k][i];
-}
-// second diag (used in LU decomposition), saved in m_lower
-double band_matrix::saved_diag(int i) const
-{
-    assert( (i>=0) && (i<dim()) );
-    return m_lower[0][i];
-}
-double & band_matrix::saved_diag(int i)
+
+// cubic spline through a fixed number of points, same interpolation and
+// boundary conditions as spline, but all storage is inline and the loops
+// have compile time bounds, so fitting it never allocates
+template<int N>
+class fixed_spline
 {
-    assert( (i>=0) && (i<dim()) );
-    return m_lower[0][i];
-}
+public:
+    typedef spline::bd_type bd_type;
 
-// LR-Decomposition of a band matrix
-void band_matrix::lu_decompose()
-{
-    int  i_max,j_max;
-    int  j_min;
-    double x;
-
-    // preconditioning
-    // normalize column i so that a_ii=1
-    for(int i=0; i<this->dim(); i++) {
-        assert(this->operator()(i,i)!=0.0);
-        this->saved_diag(i)=1.0/this->operator()(i,i);
-        j_min=std::max(0,i-this->num_lower());
-        j_max=std::min(this->dim()-1,i+this->num_upper());
-        for(int j=j_min; j<=j_max; j++) {
-            this->operator()(i,j) *= this->saved_diag(i);
-        }
-        this->operator()(i,i)=1.0;          // prevents rounding errors
-    }
+private:
+    std::array<double,N> m_x,m_y;           // x,y coordinates of points
+    // f(x) = a*(x-x_i)^3 + b*(x-x_i)^2 + c*(x-x_i) + y_i
+    std::array<double,N> m_a,m_b,m_c;       // spline coefficients
+    double  m_b0, m_c0;                     // for left extrapol
+    bd_type m_left, m_right;
+    double  m_left_value, m_right_value;
+    bool    m_force_linear_extrapolation;
 
-    // Gauss LR-Decomposition
-    for(int k=0; k<this->dim(); k++) {
-        i_max=std::min(this->dim()-1,k+this->num_lower());  // num_lower not a mistake!
-        for(int i=k+1; i<=i_max; i++) {
-            assert(this->operator()(k,k)!=0.0);
-            x=-this->operator()(i,k)/this->operator()(k,k);
-            this->operator()(i,k)=-x;                         // assembly part of L
-            j_max=std::min(this->dim()-1,k+this->num_upper());
-            for(int j=k+1; j<=j_max; j++) {
-                // assembly part of R
-                this->operator()(i,j)=this->operator()(i,j)+x*this->operator()(k,j);
-            }
-        }
-    }
-}
-// solves Ly=b
-std::vector<double> band_matrix::l_solve(const std::vector<double>& b) const
-{
-    assert( this->dim()==(int)b.size() );
-    std::vector<double> x(this->dim());
-    int j_start;
-    double sum;
-    for(int i=0; i<this->dim(); i++) {
-        sum=0;
-        j_start=std::max(0,i-this->num_lower());
-        for(int j=j_start; j<i; j++) sum += this->operator()(i,j)*x[j];
-        x[i]=(b[i]*this->saved_diag(i)) - sum;
-    }
-    return x;
-}
-// solves Rx=y
-std::vector<double> band_matrix::r_solve(const std::vector<double>& b) const
-{
-    assert( this->dim()==(int)b.size() );
-    std::vector<double> x(this->dim());
-    int j_stop;
-    double sum;
-    for(int i=this->dim()-1; i>=0; i--) {
-        sum=0;
-        j_stop=std::min(this->dim()-1,i+this->num_upper());
-        for(int j=i+1; j<=j_stop; j++) sum += this->operator()(i,j)*x[j];
-        x[i]=( b[i] - sum ) / this->operator()(i,i);
+public:
+    // set default boundary condition to be zero curvature at both ends
+    fixed_spline(): m_left(spline::second_deriv), m_right(spline::second_deriv),
+        m_left_value(0.0), m_right_value(0.0),
+        m_force_linear_extrapolation(false)
+    {
+        static_assert(N>2, "a spline needs at least 3 points");
     }
-    return x;
-}
 
-std::vector<double> band_matrix::lu_solve(const std::vector<double>& b,
-        bool is_lu_decomposed)
+    // optional, but if called it has to come be before set_points()
+    void set_boundary(bd_type left, double left_value,
+                      bd_type right, double right_value,
+                      bool force_linear_extrapolation=false);
+    void set_points(const std::array<double,N>& x,
+                    const std::array<double,N>& y, bool cubic_spline=true);
+    // same, for N points stored anywhere
+    void set_points(const double* x, const double* y, bool cubic_spline=true);
+    double operator() (double x) const;
+    // derivative of the given order (1, 2 or 3) at x
+    double deriv(int order, double x) const;
+    // curvature of the graph y=f(x) at x, f''/(1+f'^2)^(3/2)
+    double curvature(double x) const;
+    // evaluates the spline at n points, fastest when xs[] is sorted
+    void eval(const double* xs, double* out, size_t n) const;
+    // same for the derivative of the given order and for the curvature
+    void deriv(int order, const double* xs, double* out, size_t n) const;
+    void curvature(const double* xs, double* out, size_t n) const;
+};
+
+
+// parametric cubic spline (x(t), y(t)) through N points in the plane, so
+// the points need not be monotone in either coordinate. Both coordinates
+// share the knots t[], by default the accumulated chord length, which
+// approximates the arc length. Natural boundary conditions at both ends.
+template<int N>
+class fixed_spline2d
 {
-    assert( this->dim()==(int)b.size() );
-    std::vector<double>  x,y;
-    if(is_lu_decomposed==false) {
-        this->lu_decompose();
-    }
-    y=this->l_solve(b);
-    x=this->r_solve(y);
-    return x;
-}
+private:
+    std::array<double,N> m_t;               // knots
+    fixed_spline<N> m_sx, m_sy;             // x(t), y(t)
 
+public:
+    // fits through (x[i], y[i]) with chord length knots, consecutive
+    // points must differ
+    void set_points(const double* x, const double* y);
+    // same, with given increasing knots
+    void set_points(const double* t, const double* x, const double* y);
+    // knot i, the parameter of the i-th point
+    double knot(int i) const { return m_t[i]; }
+    void operator() (double t, double& x, double& y) const;
+    // derivatives of the given order (1, 2 or 3) of both coordinates
+    void deriv(int order, double t, double& dx, double& dy) const;
+    // |dC/dt|, for arc length computations
+    double speed(double t) const;
+    // curvature of the curve at t, signed positive when turning left
+    double curvature(double t) const;
+    // evaluates the curve at n parameters, fastest when ts[] is sorted
+    void eval(const double* ts, double* xs, double* ys, size_t n) const;
+};
 
 
 
+// ---------------------------------------------------------------------
+// implementation part, which could be separated into a cpp file
+// ---------------------------------------------------------------------
+
+
 // spline implementation
 // -----------------------
 
-void spline::set_boundary(spline::bd_type left, double left_value,
+inline void spline::set_boundary(spline::bd_type left, double left_value,
                           spline::bd_type right, double right_value,
                           bool force_linear_extrapolation)
 {
@@ -295,53 +235,31 @@ void spline::set_points(const std::vector<double>& x,
     }
 
     if(cubic_spline==true) { // cubic spline interpolation
-        // setting up the matrix and right hand side of the equation system
-        // for the parameters b[]
-        band_matrix A(n,1,1);
-        std::vector<double>  rhs(n);
-        for(int i=1; i<n-1; i++) {
-            A(i,i-1)=1.0/3.0*(x[i]-x[i-1]);
-            A(i,i)=2.0/3.0*(x[i+1]-x[i-1]);
-            A(i,i+1)=1.0/3.0*(x[i+1]-x[i]);
-            rhs[i]=(y[i+1]-y[i])/(x[i+1]-x[i]) - (y[i]-y[i-1])/(x[i]-x[i-1]);
-        }
-        // boundary conditions
-        if(m_left == spline::second_deriv) {
-            // 2*b[0] = f''
-            A(0,0)=2.0;
-            A(0,1)=0.0;
-            rhs[0]=m_left_value;
-        } else if(m_left == spline::first_deriv) {
-            // c[0] = f', needs to be re-expressed in terms of b:
-            // (2b[0]+b[1])(x[1]-x[0]) = 3 ((y[1]-y[0])/(x[1]-x[0]) - f')
-            A(0,0)=2.0*(x[1]-x[0]);
-            A(0,1)=1.0*(x[1]-x[0]);
-            rhs[0]=3.0*((y[1]-y[0])/(x[1]-x[0])-m_left_value);
-        } else {
-            assert(false);
+        // the equation system for the parameters b[] is tridiagonal, it is
+        // solved with the Thomas algorithm, rows are assembled during the
+        // forward sweep and m_c[], m_b[] hold the modified upper diagonal
+        // and right hand side, so no matrix or temporaries are allocated
+        m_a.resize(n);
+        m_b.resize(n);
+        m_c.resize(n);
+        double lower=0.0, diag=1.0, upper=0.0, rhs=0.0;
+        for(int i=0; i<n; i++) {
+            cubic_spline_row(x, y, n, i, m_left, m_left_value,
+                             m_right, m_right_value, lower, diag, upper, rhs);
+            if(i>0) {
+                diag -= lower*m_c[i-1];
+                rhs  -= lower*m_b[i-1];
+            }
+            assert(diag!=0.0);
+            m_c[i]=upper/diag;
+            m_b[i]=rhs/diag;
         }
-        if(m_right == spline::second_deriv) {
-            // 2*b[n-1] = f''
-            A(n-1,n-1)=2.0;
-            A(n-1,n-2)=0.0;
-            rhs[n-1]=m_right_value;
-        } else if(m_right == spline::first_deriv) {
-            // c[n-1] = f', needs to be re-expressed in terms of b:
-            // (b[n-2]+2b[n-1])(x[n-1]-x[n-2])
-            // = 3 (f' - (y[n-1]-y[n-2])/(x[n-1]-x[n-2]))
-            A(n-1,n-1)=2.0*(x[n-1]-x[n-2]);
-            A(n-1,n-2)=1.0*(x[n-1]-x[n-2]);
-            rhs[n-1]=3.0*(m_right_value-(y[n-1]-y[n-2])/(x[n-1]-x[n-2]));
-        } else {
-            assert(false);
+        // back substitution
+        for(int i=n-2; i>=0; i--) {
+            m_b[i] -= m_c[i]*m_b[i+1];
         }
 
-        // solve the equation system to obtain the parameters b[]
-        m_b=A.lu_solve(rhs);
-
         // calculate parameters a[] and c[] based on b[]
-        m_a.resize(n);
-        m_c.resize(n);
         for(int i=0; i<n-1; i++) {
             m_a[i]=1.0/3.0*(m_b[i+1]-m_b[i])/(x[i+1]-x[i]);
             m_c[i]=(y[i+1]-y[i])/(x[i+1]-x[i])
@@ -372,6 +290,52 @@ void spline::set_points(const std::vector<double>& x,
         m_b[n-1]=0.0;
 }
 
+template<typename Points>
+void cubic_spline_row(const Points& x, const Points& y, int n, int i,
+                      spline::bd_type left, double left_value,
+                      spline::bd_type right, double right_value,
+                      double& lower, double& diag, double& upper, double& rhs)
+{
+    lower=0.0;
+    upper=0.0;
+    if(i>0 && i<n-1) {
+        lower=1.0/3.0*(x[i]-x[i-1]);
+        diag=2.0/3.0*(x[i+1]-x[i-1]);
+        upper=1.0/3.0*(x[i+1]-x[i]);
+        rhs=(y[i+1]-y[i])/(x[i+1]-x[i]) - (y[i]-y[i-1])/(x[i]-x[i-1]);
+    } else if(i==0) {
+        // boundary conditions
+        if(left == spline::second_deriv) {
+            // 2*b[0] = f''
+            diag=2.0;
+            rhs=left_value;
+        } else if(left == spline::first_deriv) {
+            // c[0] = f', needs to be re-expressed in terms of b:
+            // (2b[0]+b[1])(x[1]-x[0]) = 3 ((y[1]-y[0])/(x[1]-x[0]) - f')
+            diag=2.0*(x[1]-x[0]);
+            upper=1.0*(x[1]-x[0]);
+            rhs=3.0*((y[1]-y[0])/(x[1]-x[0])-left_value);
+        } else {
+            assert(false);
+        }
+    } else {
+        if(right == spline::second_deriv) {
+            // 2*b[n-1] = f''
+            diag=2.0;
+            rhs=right_value;
+        } else if(right == spline::first_deriv) {
+            // c[n-1] = f', needs to be re-expressed in terms of b:
+            // (b[n-2]+2b[n-1])(x[n-1]-x[n-2])
+            // = 3 (f' - (y[n-1]-y[n-2])/(x[n-1]-x[n-2]))
+            diag=2.0*(x[n-1]-x[n-2]);
+            lower=1.0*(x[n-1]-x[n-2]);
+            rhs=3.0*(right_value-(y[n-1]-y[n-2])/(x[n-1]-x[n-2]));
+        } else {
+            assert(false);
+        }
+    }
+}
+
 double spline::operator() (double x) const
 {
     size_t n=m_x.size();
@@ -395,6 +359,384 @@ double spline::operator() (double x) const
     return interpol;
 }
 
+double spline::deriv(int order, double x) const
+{
+    assert(order>0);
+    size_t n=m_x.size();
+    std::vector<double>::const_iterator it;
+    it=std::lower_bound(m_x.begin(),m_x.end(),x);
+    int idx=std::max( int(it-m_x.begin())-1, 0);
+
+    double h=x-m_x[idx];
+    if(x<m_x[0]) {
+        // extrapolation to the left
+        return cubic_poly_deriv(order, 0.0, m_b0, m_c0, m_y[0], h);
+    } else if(x>m_x[n-1]) {
+        // extrapolation to the right, m_a[n-1]=0
+        return cubic_poly_deriv(order, 0.0, m_b[n-1], m_c[n-1], m_y[n-1], h);
+    }
+    return cubic_poly_deriv(order, m_a[idx], m_b[idx], m_c[idx], m_y[idx], h);
+}
+
+inline double spline::curvature(double x) const
+{
+    double d1=deriv(1, x);
+    double q=1.0+d1*d1;
+    return deriv(2, x)/(q*sqrt(q));
+}
+
+
+// derivatives
+// -----------
+
+double cubic_poly_deriv(int order, double a, double b, double c, double y,
+                        double h)
+{
+    switch(order) {
+    case 0:
+        return ((a*h + b)*h + c)*h + y;
+    case 1:
+        return (3.0*a*h + 2.0*b)*h + c;
+    case 2:
+        return 6.0*a*h + 2.0*b;
+    case 3:
+        return 6.0*a;
+    default:
+        return 0.0;
+    }
+}
+
+
+// batch evaluation
+// ----------------
+
+void cubic_spline_eval(const double* x, const double* y, const double* a,
+                       const double* b, const double* c, double b0, double c0,
+                       int n, const double* xs, double* out, size_t count,
+                       int order)
+{
+    // queries are handled in chunks: the segment search gathers the
+    // polynomial of every query into flat arrays, then the polynomials are
+    // evaluated in a loop without branches or lookups, which the compiler
+    // turns into SIMD code
+    const size_t chunk=64;
+    double qx[chunk], qa[chunk], qb[chunk], qc[chunk], qy[chunk];
+    int cur=0;      // number of points with x[i] < current query
+    for(size_t k0=0; k0<count; k0+=chunk) {
+        size_t m=std::min(chunk, count-k0);
+        for(size_t k=0; k<m; k++) {
+            double xq=xs[k0+k];
+            while(cur<n && x[cur]<xq) cur++;
+            while(cur>0 && x[cur-1]>=xq) cur--;
+            int idx=std::max(cur-1, 0);
+            qx[k]=x[idx];
+            qy[k]=y[idx];
+            if(xq<x[0]) {
+                // extrapolation to the left
+                qa[k]=0.0;
+                qb[k]=b0;
+                qc[k]=c0;
+            } else {
+                // interpolation, or extrapolation to the right with
+                // a[n-1]=0
+                qa[k]=a[idx];
+                qb[k]=b[idx];
+                qc[k]=c[idx];
+            }
+        }
+        // one loop per order, so none of them branches
+        double* o=out+k0;
+        switch(order) {
+        case 0:
+            for(size_t k=0; k<m; k++) {
+                double h=xs[k0+k]-qx[k];
+                o[k]=((qa[k]*h + qb[k])*h + qc[k])*h + qy[k];
+            }
+            break;
+        case 1:
+            for(size_t k=0; k<m; k++) {
+                double h=xs[k0+k]-qx[k];
+                o[k]=(3.0*qa[k]*h + 2.0*qb[k])*h + qc[k];
+            }
+            break;
+        case 2:
+            for(size_t k=0; k<m; k++) {
+                double h=xs[k0+k]-qx[k];
+                o[k]=6.0*qa[k]*h + 2.0*qb[k];
+            }
+            break;
+        case 3:
+            for(size_t k=0; k<m; k++) {
+                o[k]=6.0*qa[k];
+            }
+            break;
+        default:
+            for(size_t k=0; k<m; k++) {
+                o[k]=0.0;
+            }
+        }
+    }
+}
+
+void cubic_spline_curvature(const double* x, const double* y, const double* a,
+                            const double* b, const double* c, double b0, double c0,
+                            int n, const double* xs, double* out, size_t count)
+{
+    const size_t chunk=64;
+    double d1[chunk];
+    for(size_t k0=0; k0<count; k0+=chunk) {
+        size_t m=std::min(chunk, count-k0);
+        cubic_spline_eval(x, y, a, b, c, b0, c0, n, xs+k0, d1, m, 1);
+        cubic_spline_eval(x, y, a, b, c, b0, c0, n, xs+k0, out+k0, m, 2);
+        for(size_t k=0; k<m; k++) {
+            double q=1.0+d1[k]*d1[k];
+            out[k0+k] /= q*sqrt(q);
+        }
+    }
+}
+
+inline void spline::eval(const double* xs, double* out, size_t n) const
+{
+    cubic_spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                      m_b0, m_c0, m_x.size(), xs, out, n);
+}
+
+inline void spline::deriv(int order, const double* xs, double* out, size_t n) const
+{
+    assert(order>0);
+    cubic_spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                      m_b0, m_c0, m_x.size(), xs, out, n, order);
+}
+
+inline void spline::curvature(const double* xs, double* out, size_t n) const
+{
+    cubic_spline_curvature(m_x.data(), m_y.data(), m_a.data(), m_b.data(),
+                           m_c.data(), m_b0, m_c0, m_x.size(), xs, out, n);
+}
+
+// fixed_spline implementation
+// ---------------------------
+
+template<int N>
+void fixed_spline<N>::set_boundary(bd_type left, double left_value,
+                                   bd_type right, double right_value,
+                                   bool force_linear_extrapolation)
+{
+    m_left=left;
+    m_right=right;
+    m_left_value=left_value;
+    m_right_value=right_value;
+    m_force_linear_extrapolation=force_linear_extrapolation;
+}
+
+template<int N>
+void fixed_spline<N>::set_points(const std::array<double,N>& x,
+                                 const std::array<double,N>& y, bool cubic_spline)
+{
+    set_points(x.data(), y.data(), cubic_spline);
+}
+
+template<int N>
+void fixed_spline<N>::set_points(const double* x, const double* y,
+                                 bool cubic_spline)
+{
+    for(int i=0; i<N; i++) {
+        m_x[i]=x[i];
+        m_y[i]=y[i];
+    }
+    for(int i=0; i<N-1; i++) {
+        assert(m_x[i]<m_x[i+1]);
+    }
+
+    if(cubic_spline==true) { // cubic spline interpolation
+        // Thomas algorithm as in spline::set_points()
+        double lower=0.0, diag=1.0, upper=0.0, rhs=0.0;
+        for(int i=0; i<N; i++) {
+            cubic_spline_row(m_x, m_y, N, i, m_left, m_left_value,
+                             m_right, m_right_value, lower, diag, upper, rhs);
+            if(i>0) {
+                diag -= lower*m_c[i-1];
+                rhs  -= lower*m_b[i-1];
+            }
+            assert(diag!=0.0);
+            m_c[i]=upper/diag;
+            m_b[i]=rhs/diag;
+        }
+        for(int i=N-2; i>=0; i--) {
+            m_b[i] -= m_c[i]*m_b[i+1];
+        }
+        for(int i=0; i<N-1; i++) {
+            m_a[i]=1.0/3.0*(m_b[i+1]-m_b[i])/(m_x[i+1]-m_x[i]);
+            m_c[i]=(m_y[i+1]-m_y[i])/(m_x[i+1]-m_x[i])
+                   - 1.0/3.0*(2.0*m_b[i]+m_b[i+1])*(m_x[i+1]-m_x[i]);
+        }
+    } else { // linear interpolation
+        for(int i=0; i<N-1; i++) {
+            m_a[i]=0.0;
+            m_b[i]=0.0;
+            m_c[i]=(m_y[i+1]-m_y[i])/(m_x[i+1]-m_x[i]);
+        }
+    }
+
+    // for left extrapolation coefficients
+    m_b0 = (m_force_linear_extrapolation==false) ? m_b[0] : 0.0;
+    m_c0 = m_c[0];
+
+    // for the right extrapolation coefficients
+    double h=m_x[N-1]-m_x[N-2];
+    m_a[N-1]=0.0;
+    m_c[N-1]=3.0*m_a[N-2]*h*h+2.0*m_b[N-2]*h+m_c[N-2];   // = f'_{n-2}(x_{n-1})
+    if(m_force_linear_extrapolation==true || cubic_spline==false)
+        m_b[N-1]=0.0;
+}
+
+template<int N>
+double fixed_spline<N>::operator() (double x) const
+{
+    // find the closest point m_x[idx] < x, idx=0 even if x<m_x[0],
+    // by counting instead of a binary search, N is small
+    int idx=-1;
+    for(int i=0; i<N; i++) {
+        idx += (m_x[i]<x);
+    }
+    idx=std::max(idx, 0);
+
+    double h=x-m_x[idx];
+    double interpol;
+    if(x<m_x[0]) {
+        // extrapolation to the left
+        interpol=(m_b0*h + m_c0)*h + m_y[0];
+    } else if(x>m_x[N-1]) {
+        // extrapolation to the right
+        interpol=(m_b[N-1]*h + m_c[N-1])*h + m_y[N-1];
+    } else {
+        // interpolation
+        interpol=((m_a[idx]*h + m_b[idx])*h + m_c[idx])*h + m_y[idx];
+    }
+    return interpol;
+}
+
+template<int N>
+double fixed_spline<N>::deriv(int order, double x) const
+{
+    assert(order>0);
+    int idx=-1;
+    for(int i=0; i<N; i++) {
+        idx += (m_x[i]<x);
+    }
+    idx=std::max(idx, 0);
+
+    double h=x-m_x[idx];
+    if(x<m_x[0]) {
+        // extrapolation to the left
+        return cubic_poly_deriv(order, 0.0, m_b0, m_c0, m_y[0], h);
+    }
+    // interpolation, or extrapolation to the right with m_a[N-1]=0
+    return cubic_poly_deriv(order, m_a[idx], m_b[idx], m_c[idx], m_y[idx], h);
+}
+
+template<int N>
+double fixed_spline<N>::curvature(double x) const
+{
+    double d1=deriv(1, x);
+    double q=1.0+d1*d1;
+    return deriv(2, x)/(q*sqrt(q));
+}
+
+template<int N>
+void fixed_spline<N>::eval(const double* xs, double* out, size_t n) const
+{
+    cubic_spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                      m_b0, m_c0, N, xs, out, n);
+}
+
+template<int N>
+void fixed_spline<N>::deriv(int order, const double* xs, double* out, size_t n) const
+{
+    assert(order>0);
+    cubic_spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                      m_b0, m_c0, N, xs, out, n, order);
+}
+
+template<int N>
+void fixed_spline<N>::curvature(const double* xs, double* out, size_t n) const
+{
+    cubic_spline_curvature(m_x.data(), m_y.data(), m_a.data(), m_b.data(),
+                           m_c.data(), m_b0, m_c0, N, xs, out, n);
+}
+
+
+
+// fixed_spline2d implementation
+// -----------------------------
+
+template<int N>
+void fixed_spline2d<N>::set_points(const double* x, const double* y)
+{
+    double t[N];
+    t[0]=0.0;
+    for(int i=1; i<N; i++) {
+        t[i]=t[i-1]+sqrt((x[i]-x[i-1])*(x[i]-x[i-1])+(y[i]-y[i-1])*(y[i]-y[i-1]));
+    }
+    set_points(t, x, y);
+}
+
+template<int N>
+void fixed_spline2d<N>::set_points(const double* t, const double* x,
+                                   const double* y)
+{
+    for(int i=0; i<N; i++) {
+        m_t[i]=t[i];
+    }
+    m_sx.set_points(m_t.data(), x);
+    m_sy.set_points(m_t.data(), y);
+}
+
+template<int N>
+void fixed_spline2d<N>::operator() (double t, double& x, double& y) const
+{
+    x=m_sx(t);
+    y=m_sy(t);
+}
+
+template<int N>
+void fixed_spline2d<N>::deriv(int order, double t, double& dx, double& dy) const
+{
+    dx=m_sx.deriv(order, t);
+    dy=m_sy.deriv(order, t);
+}
+
+template<int N>
+double fixed_spline2d<N>::speed(double t) const
+{
+    double dx, dy;
+    deriv(1, t, dx, dy);
+    return sqrt(dx*dx+dy*dy);
+}
+
+template<int N>
+double fixed_spline2d<N>::curvature(double t) const
+{
+    double dx, dy, ddx, ddy;
+    deriv(1, t, dx, dy);
+    deriv(2, t, ddx, ddy);
+    double q=dx*dx+dy*dy;
+    return (dx*ddy-dy*ddx)/(q*sqrt(q));
+}
+
+template<int N>
+void fixed_spline2d<N>::eval(const double* ts, double* xs, double* ys,
+                             size_t n) const
+{
+    // both coordinates chunk by chunk, so the queries stay in cache
+    const size_t chunk=64;
+    for(size_t k0=0; k0<n; k0+=chunk) {
+        size_t m=std::min(chunk, n-k0);
+        m_sx.eval(ts+k0, xs+k0, m);
+        m_sy.eval(ts+k0, ys+k0, m);
+    }
+}
+
 
 } // namespace tk
 
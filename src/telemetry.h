@@ -0,0 +1,226 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "sensor_fusion.h"
+
+// for convenience
+using std::vector;
+
+//
+// Schema-aware decoder for the simulator's SocketIO telemetry frames.
+//
+// The frame is scanned once, straight from the websocket buffer, and the
+// known fields are written into a reusable Telemetry struct. No JSON DOM is
+// built and the payload is never copied, so the vectors keep their capacity
+// from tick to tick and a steady-state parse does not allocate.
+//
+
+// Decoded content of a 42["telemetry",{...}] frame. Fields missing from
+// the frame are left at zero or empty.
+struct Telemetry {
+  // Main car's localization Data
+  double x = 0.0;
+  double y = 0.0;
+  double s = 0.0;
+  double d = 0.0;
+  double yaw = 0.0;
+  double speed = 0.0;
+
+  // Previous path data given to the Planner
+  vector<double> previous_path_x;
+  vector<double> previous_path_y;
+  // Previous path's end s and d values
+  double end_path_s = 0.0;
+  double end_path_d = 0.0;
+
+  // Sensor Fusion Data, a list of all other cars on the same side of the road.
+  SensorFusionFrame sensor_fusion;
+
+  // back to the defaults, the vectors keep their capacity
+  void clear() {
+    x = y = s = d = yaw = speed = 0.0;
+    previous_path_x.clear();
+    previous_path_y.clear();
+    end_path_s = end_path_d = 0.0;
+    sensor_fusion.clear();
+  }
+};
+
+// Outcome of decoding a frame
+enum TelemetryStatus {
+  TELEMETRY_OK,       // telemetry event with data, Telemetry is filled
+  TELEMETRY_MANUAL,   // event without data, the simulator is in manual mode
+  TELEMETRY_IGNORED   // other event or malformed frame, or previous path
+                      // coordinates of different lengths
+};
+
+class TelemetryParser {
+ public:
+  TelemetryParser(const char *data, size_t length)
+    : p_(data), end_(data + length) {}
+
+  TelemetryStatus parse(Telemetry &t) {
+    // "42" at the start of the message means there's a websocket message event.
+    if (!consume('4') || !consume('2') || !consume('[')) return TELEMETRY_IGNORED;
+    const char *event;
+    size_t event_len;
+    if (!parse_string(event, event_len) || !consume(',')) return TELEMETRY_IGNORED;
+    skip_ws();
+    if (p_ < end_ && *p_ != '{') return TELEMETRY_MANUAL;
+    if (event_len != 9 || memcmp(event, "telemetry", 9) != 0) {
+      return TELEMETRY_IGNORED;
+    }
+    return parse_object(t) ? TELEMETRY_OK : TELEMETRY_IGNORED;
+  }
+
+ private:
+  const char *p_;
+  const char *end_;
+
+  void skip_ws() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      ++p_;
+    }
+  }
+
+  bool consume(char c) {
+    skip_ws();
+    if (p_ < end_ && *p_ == c) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  // points into the frame, escapes are skipped but not decoded
+  bool parse_string(const char *&str, size_t &len) {
+    if (!consume('"')) return false;
+    str = p_;
+    while (p_ < end_ && *p_ != '"') {
+      if (*p_ == '\\') ++p_;
+      ++p_;
+    }
+    if (p_ >= end_) return false;
+    len = p_ - str;
+    ++p_;
+    return true;
+  }
+
+  bool parse_number(double &value) {
+    skip_ws();
+    // the frame is not null terminated, so strtod works on a bounded copy
+    char buf[64];
+    size_t n = 0;
+    while (p_ < end_ && n < sizeof(buf) - 1 &&
+           ((*p_ >= '0' && *p_ <= '9') || *p_ == '-' || *p_ == '+' ||
+            *p_ == '.' || *p_ == 'e' || *p_ == 'E')) {
+      buf[n++] = *p_++;
+    }
+    if (n == 0) return false;
+    buf[n] = '\0';
+    char *stop;
+    value = strtod(buf, &stop);
+    return stop == buf + n;
+  }
+
+  bool parse_number_array(vector<double> &out) {
+    out.clear();
+    if (!consume('[')) return false;
+    if (consume(']')) return true;
+    do {
+      double value;
+      if (!parse_number(value)) return false;
+      out.push_back(value);
+    } while (consume(','));
+    return consume(']');
+  }
+
+  // [[id, x, y, vx, vy, s, d], ...]
+  bool parse_sensor_fusion(SensorFusionFrame &out) {
+    out.clear();
+    if (!consume('[')) return false;
+    if (consume(']')) return true;
+    do {
+      double v[7];
+      if (!consume('[')) return false;
+      for (int i = 0; i < 7; ++i) {
+        if ((i > 0 && !consume(',')) || !parse_number(v[i])) return false;
+      }
+      if (!consume(']')) return false;
+      out.push_back((int)v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+    } while (consume(','));
+    return consume(']');
+  }
+
+  // skips any JSON value of a field the planner does not use
+  bool skip_value() {
+    skip_ws();
+    if (p_ >= end_) return false;
+    if (*p_ == '"') {
+      const char *str;
+      size_t len;
+      return parse_string(str, len);
+    }
+    if (*p_ == '[' || *p_ == '{') {
+      int depth = 0;
+      while (p_ < end_) {
+        char c = *p_;
+        if (c == '"') {
+          const char *str;
+          size_t len;
+          if (!parse_string(str, len)) return false;
+          continue;
+        }
+        ++p_;
+        if (c == '[' || c == '{') ++depth;
+        else if ((c == ']' || c == '}') && --depth == 0) return true;
+      }
+      return false;
+    }
+    // number, true, false or null
+    while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ']') ++p_;
+    return true;
+  }
+
+  static bool key_is(const char *key, size_t len, const char *name) {
+    return len == strlen(name) && memcmp(key, name, len) == 0;
+  }
+
+  bool parse_object(Telemetry &t) {
+    // nothing may carry over from the last frame parsed into t
+    t.clear();
+    if (!consume('{')) return false;
+    if (consume('}')) return true;
+    do {
+      const char *key;
+      size_t len;
+      if (!parse_string(key, len) || !consume(':')) return false;
+      bool ok;
+      if (key_is(key, len, "x")) ok = parse_number(t.x);
+      else if (key_is(key, len, "y")) ok = parse_number(t.y);
+      else if (key_is(key, len, "s")) ok = parse_number(t.s);
+      else if (key_is(key, len, "d")) ok = parse_number(t.d);
+      else if (key_is(key, len, "yaw")) ok = parse_number(t.yaw);
+      else if (key_is(key, len, "speed")) ok = parse_number(t.speed);
+      else if (key_is(key, len, "previous_path_x")) ok = parse_number_array(t.previous_path_x);
+      else if (key_is(key, len, "previous_path_y")) ok = parse_number_array(t.previous_path_y);
+      else if (key_is(key, len, "end_path_s")) ok = parse_number(t.end_path_s);
+      else if (key_is(key, len, "end_path_d")) ok = parse_number(t.end_path_d);
+      else if (key_is(key, len, "sensor_fusion")) ok = parse_sensor_fusion(t.sensor_fusion);
+      else ok = skip_value();
+      if (!ok) return false;
+    } while (consume(','));
+    // the planner indexes both coordinates by the x count
+    return consume('}') && t.previous_path_x.size() == t.previous_path_y.size();
+  }
+};
+
+// Decodes a raw websocket frame into t, reusing its storage
+TelemetryStatus parse_telemetry(const char *data, size_t length, Telemetry &t) {
+  return TelemetryParser(data, length).parse(t);
+}
+
+#endif  // TELEMETRY_H
@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed pool of worker threads for data parallel loops.
+//
+// parallel_for(n, body) runs body(i) for every i in [0, n). The workers and
+// the calling thread take indices from a shared counter, so uneven work per
+// index balances itself. The call returns once every index is done. The
+// threads are started once and sleep between loops, so a loop costs one
+// wake up rather than thread creation.
+//
+
+class ThreadPool {
+ public:
+  // threads < 0 uses one worker per hardware thread besides the caller,
+  // 0 runs every loop on the calling thread alone
+  explicit ThreadPool(int threads = -1) {
+    if (threads < 0) {
+      threads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+    }
+    for (int i = 0; i < threads; ++i) {
+      workers_.push_back(std::thread(&ThreadPool::worker, this));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i].join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // number of threads running a loop, the caller included
+  int size() const { return workers_.size() + 1; }
+
+  void parallel_for(int n, const std::function<void(int)> &body) {
+    if (n <= 0) return;
+    if (workers_.empty() || n == 1) {
+      for (int i = 0; i < n; ++i) body(i);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      body_ = &body;
+      n_ = n;
+      next_ = 0;
+      active_ = workers_.size();
+      ++generation_;
+    }
+    wake_.notify_all();
+    run();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return active_ == 0; });
+    body_ = nullptr;
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  // the current loop
+  const std::function<void(int)> *body_ = nullptr;
+  int n_ = 0;
+  std::atomic<int> next_{0};
+  // workers still in the current loop
+  int active_ = 0;
+  unsigned long generation_ = 0;
+  bool stop_ = false;
+
+  void run() {
+    for (int i = next_++; i < n_; i = next_++) {
+      (*body_)(i);
+    }
+  }
+
+  void worker() {
+    unsigned long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+      }
+      run();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_;
+      }
+      done_.notify_one();
+    }
+  }
+};
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,210 @@
+#ifndef WAYPOINT_GRID_H
+#define WAYPOINT_GRID_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+// for convenience
+using std::vector;
+
+//
+// Uniform grid spatial index over the map waypoints.
+//
+// Built once from the waypoint coordinates, it answers nearest waypoint and
+// nearest segment queries by visiting grid cells in rings around the query
+// point, stopping as soon as no unvisited cell can hold anything closer.
+// Queries outside the grid start from the nearest cell on its border. A
+// query far from every waypoint would visit most of the grid ring by ring,
+// so after MAX_RINGS rings the search falls back to a linear scan.
+// Cell contents are stored in one flat array with per-cell offsets.
+// Segment i runs from waypoint i to waypoint i+1, the last one closes the loop
+// back to waypoint 0.
+//
+
+class WaypointGrid {
+ public:
+  WaypointGrid() {}
+
+  // The grid reads the n waypoints in place, they must outlive it.
+  // cell_size <= 0 picks the mean segment length.
+  void build(const double *maps_x, const double *maps_y, int n, double cell_size = 0.0) {
+    maps_x_ = maps_x;
+    maps_y_ = maps_y;
+    n_ = n;
+    if (n == 0) return;
+
+    min_x_ = *std::min_element(maps_x_, maps_x_ + n);
+    min_y_ = *std::min_element(maps_y_, maps_y_ + n);
+    double max_x = *std::max_element(maps_x_, maps_x_ + n);
+    double max_y = *std::max_element(maps_y_, maps_y_ + n);
+
+    if (cell_size <= 0.0) {
+      double total = 0.0;
+      for (int i = 0; i < n; ++i) {
+        int j = (i + 1) % n;
+        total += sqrt(sq(maps_x_[j] - maps_x_[i]) + sq(maps_y_[j] - maps_y_[i]));
+      }
+      cell_size = std::max(total / n, 1.0);
+    }
+    // keep the number of cells in proportion to the number of waypoints
+    while (((max_x - min_x_) / cell_size + 1) * ((max_y - min_y_) / cell_size + 1) > 4.0 * n + 16) {
+      cell_size *= 2;
+    }
+    cell_size_ = cell_size;
+    cols_ = (int)((max_x - min_x_) / cell_size_) + 1;
+    rows_ = (int)((max_y - min_y_) / cell_size_) + 1;
+
+    // waypoints, bucketed by the cell they are in
+    vector<int> point_cells(n);
+    vector<int> point_ids(n);
+    for (int i = 0; i < n; ++i) {
+      point_cells[i] = cell_of(maps_x_[i], maps_y_[i]);
+      point_ids[i] = i;
+    }
+    fill_cells(point_cells, point_ids, point_start_, points_);
+
+    // segments, bucketed by every cell their bounding box overlaps
+    vector<int> seg_cells;
+    vector<int> seg_ids;
+    for (int i = 0; i < n; ++i) {
+      int j = (i + 1) % n;
+      int c0 = clamp_col(std::min(maps_x_[i], maps_x_[j]));
+      int c1 = clamp_col(std::max(maps_x_[i], maps_x_[j]));
+      int r0 = clamp_row(std::min(maps_y_[i], maps_y_[j]));
+      int r1 = clamp_row(std::max(maps_y_[i], maps_y_[j]));
+      for (int r = r0; r <= r1; ++r) {
+        for (int c = c0; c <= c1; ++c) {
+          seg_cells.push_back(r * cols_ + c);
+          seg_ids.push_back(i);
+        }
+      }
+    }
+    fill_cells(seg_cells, seg_ids, segment_start_, segments_);
+  }
+
+  int size() const { return n_; }
+
+  // index of the waypoint closest to x, y
+  int closest_waypoint(double x, double y) const {
+    int best = 0;
+    double best_dist = 1e300;
+    search(x, y, point_start_, points_, best, best_dist, false);
+    return best;
+  }
+
+  // index of the segment closest to x, y; the segment runs from waypoint
+  // index to waypoint (index+1) % size()
+  int closest_segment(double x, double y) const {
+    int best = 0;
+    double best_dist = 1e300;
+    search(x, y, segment_start_, segments_, best, best_dist, true);
+    return best;
+  }
+
+ private:
+  const double *maps_x_ = nullptr;
+  const double *maps_y_ = nullptr;
+  int n_ = 0;
+  double min_x_ = 0.0;
+  double min_y_ = 0.0;
+  double cell_size_ = 1.0;
+  int cols_ = 0;
+  int rows_ = 0;
+  // per-cell offsets into the flat index arrays, one more than cells
+  vector<int> point_start_;
+  vector<int> points_;
+  vector<int> segment_start_;
+  vector<int> segments_;
+
+  static double sq(double v) { return v * v; }
+
+  // rings searched before falling back to a linear scan
+  static const int MAX_RINGS = 16;
+
+  // the cell index is clamped while it is still a double, casting a value
+  // out of int range is undefined; NaN lands in cell 0
+  static int clamp_index(double v, int count) {
+    if (!(v > 0.0)) return 0;
+    if (v > count - 1) return count - 1;
+    return (int)v;
+  }
+  int clamp_col(double x) const { return clamp_index(floor((x - min_x_) / cell_size_), cols_); }
+  int clamp_row(double y) const { return clamp_index(floor((y - min_y_) / cell_size_), rows_); }
+  int cell_of(double x, double y) const { return clamp_row(y) * cols_ + clamp_col(x); }
+
+  // counting sort of (cell, id) pairs into the offset + flat array layout
+  void fill_cells(const vector<int> &cells, const vector<int> &ids,
+                  vector<int> &start, vector<int> &flat) {
+    start.assign(cols_ * rows_ + 1, 0);
+    for (size_t k = 0; k < cells.size(); ++k) ++start[cells[k] + 1];
+    for (size_t c = 1; c < start.size(); ++c) start[c] += start[c - 1];
+    flat.resize(cells.size());
+    vector<int> next(start.begin(), start.end() - 1);
+    for (size_t k = 0; k < cells.size(); ++k) {
+      flat[next[cells[k]]++] = ids[k];
+    }
+  }
+
+  // squared distance from x, y to waypoint i, or to segment i
+  double dist_sq(double x, double y, int i, bool segment) const {
+    if (!segment) return sq(x - maps_x_[i]) + sq(y - maps_y_[i]);
+    int j = (i + 1) % n_;
+    double n_x = maps_x_[j] - maps_x_[i];
+    double n_y = maps_y_[j] - maps_y_[i];
+    double x_x = x - maps_x_[i];
+    double x_y = y - maps_y_[i];
+    double len_sq = n_x * n_x + n_y * n_y;
+    double t = len_sq > 0 ? (x_x * n_x + x_y * n_y) / len_sq : 0.0;
+    t = std::min(std::max(t, 0.0), 1.0);
+    return sq(x_x - t * n_x) + sq(x_y - t * n_y);
+  }
+
+  // visits the cells ring by ring around the query point, or the grid cell
+  // closest to it: cells beyond a ring are then still at least that many
+  // cells away from the query
+  void search(double x, double y, const vector<int> &start, const vector<int> &flat,
+              int &best, double &best_dist, bool segment) const {
+    if (n_ == 0) return;
+    int qc = clamp_col(x);
+    int qr = clamp_row(y);
+    // ring at which every cell of the grid has been visited
+    int last = std::max(std::max(qc, cols_ - 1 - qc), std::max(qr, rows_ - 1 - qr));
+    int rings = (last < MAX_RINGS) ? last : MAX_RINGS;
+    for (int ring = 0; ring <= rings; ++ring) {
+      for (int r = qr - ring; r <= qr + ring; ++r) {
+        if (r < 0 || r >= rows_) continue;
+        bool edge_row = (r == qr - ring || r == qr + ring);
+        int step = edge_row ? 1 : 2 * ring;
+        for (int c = qc - ring; c <= qc + ring; c += std::max(step, 1)) {
+          if (c < 0 || c >= cols_) continue;
+          int cell = r * cols_ + c;
+          for (int k = start[cell]; k < start[cell + 1]; ++k) {
+            double dist = dist_sq(x, y, flat[k], segment);
+            if (dist < best_dist || (dist == best_dist && flat[k] < best)) {
+              best_dist = dist;
+              best = flat[k];
+            }
+          }
+        }
+      }
+      // all cells beyond this ring are at least ring cells away
+      double bound = ring * cell_size_;
+      if (best_dist <= bound * bound) return;
+    }
+    if (last > MAX_RINGS) linear_scan(x, y, best, best_dist, segment);
+  }
+
+  void linear_scan(double x, double y, int &best, double &best_dist, bool segment) const {
+    for (int i = 0; i < n_; ++i) {
+      double dist = dist_sq(x, y, i, segment);
+      if (dist < best_dist || (dist == best_dist && i < best)) {
+        best_dist = dist;
+        best = i;
+      }
+    }
+  }
+};
+
+#endif  // WAYPOINT_GRID_H